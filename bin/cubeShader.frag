@@ -21,10 +21,12 @@ in vec3 FragPos;
 in vec3 Normal;
 in vec3 ModelPos;
 in vec4 FragPosLightSpace;
+flat in int Highlighted;
 
 uniform vec3 viewPos;
 uniform sampler2D shadowMap;
 uniform Material material;
+uniform Material highlightMaterial;
 uniform Light light;
 uniform bool cube;
 
@@ -53,8 +55,10 @@ float calculateShadow(vec4 fragPosLightSpace)
 
 void main()
 {
+    Material m = (Highlighted == 1) ? highlightMaterial : material;
+
     // ambient
-    vec3 ambient = light.ambient * material.ambient;
+    vec3 ambient = light.ambient * m.ambient;
 
     //add border
     if (cube) {
@@ -68,13 +72,13 @@ void main()
     // diffuse
     vec3 norm = normalize(Normal);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * (diff * material.diffuse);
+    vec3 diffuse = light.diffuse * (diff * m.diffuse);
 
     // specular
     vec3 viewDir = normalize(viewPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * (spec * material.specular);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), m.shininess);
+    vec3 specular = light.specular * (spec * m.specular);
 
     float shadow = calculateShadow(FragPosLightSpace);
 
@@ -1,24 +1,37 @@
-
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec4 aOffset;
+layout (location = 3) in float aHeight;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec3 ModelPos;
 out vec4 FragPosLightSpace;
+flat out int Highlighted;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 uniform mat4 lightSpaceMatrix;
+uniform bool instanced;
+uniform bool highlight;
+uniform float progress;
 
 void main()
 {
-   FragPos = vec3(model * vec4(aPos, 1.0));
-   Normal = mat3(transpose(inverse(model))) * aNormal;
+   if (instanced) {
+      //cubes are only moved: to their cell and level, then by the animated change in height
+      FragPos = aPos + aOffset.xyz + vec3(0.0, aOffset.w * progress - 0.005, 0.0);
+      Normal = aNormal;
+      Highlighted = (highlight && aHeight >= 4.0) ? 1 : 0;
+   } else {
+      FragPos = vec3(model * vec4(aPos, 1.0));
+      Normal = mat3(transpose(inverse(model))) * aNormal;
+      Highlighted = 0;
+   }
    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
    ModelPos = aPos;
    gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+}
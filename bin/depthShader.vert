@@ -1,11 +1,18 @@
-
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec4 aOffset;
 
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
+uniform bool instanced;
+uniform float progress;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    vec3 worldPos;
+    if (instanced)
+        worldPos = aPos + aOffset.xyz + vec3(0.0, aOffset.w * progress - 0.005, 0.0);
+    else
+        worldPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = lightSpaceMatrix * vec4(worldPos, 1.0);
+}
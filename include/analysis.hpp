@@ -0,0 +1,112 @@
+#ifndef ANALYSIS_HPP
+#define ANALYSIS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+//maximum likelihood fit of p(s) ~ s^-alpha for sizes s in [min, max]
+struct PowerLawFit
+{
+	bool valid;
+	double alpha;
+	double error;
+	int min;
+	int max;
+	long long samples;
+};
+
+/*
+shape of one avalanche, accumulated while it relaxes. area is the number of distinct cells that toppled,
+duration the number of layers in which any cell toppled, topples the total number of topples.
+the coordinate sums over the toppled cells give the radius of gyration without another pass over them.
+*/
+struct Avalanche
+{
+	int area = 0;
+	int duration = 0;
+	long long topples = 0;
+	long long sumX = 0;
+	long long sumY = 0;
+	long long sumSquares = 0;
+	double gyration() const;
+};
+
+/*
+detects when a run has left the transient that follows e.g. a cleared plate and reached the
+stationary (self-organized critical) state. every drop adds one grain and size grains fall off the edge,
+so the mean height follows from the sizes alone. the drops are cut into windows of about one drop per cell,
+and the run counts as stationary once the mean height changed by less than tolerance over a window
+(about as many grains flow out as are dropped) and the mean avalanche size agrees with the previous window's.
+every update is O(1).
+*/
+class Stationarity
+{
+public:
+	double tolerance;
+	int window;
+	//number of drops before the stationary state, -1 while warming up
+	long long since;
+	double meanHeight;
+	//grains lost per drop, mean size and its standard error over the last complete window
+	double outflow;
+	double sizeMean;
+	double sizeError;
+	Stationarity();
+	void reset(int cells, int capacity);
+	bool add(int size);
+	bool stationary() const;
+private:
+	long long drops;
+	int cells;
+	long long capacity;
+	long long windowCapacity;
+	int count;
+	double sum;
+	double sumSquares;
+	bool havePrevious;
+};
+
+/*
+avalanche size statistics, updated one drop at a time. memory grows with the largest avalanche,
+not with the number of drops, so the raw sizes never have to be kept.
+with skipWarmup set, only the drops after the run became stationary are counted.
+the area, duration and topples of every avalanche are counted the same way as the sizes.
+*/
+class SizeStats
+{
+public:
+	static const int binsPerOctave = 4;
+	long long drops;
+	long long skipped;
+	//number of drops of every size, indexed by size
+	std::vector<long long> freq;
+	//number of drops in every logarithmic bin, bin k holds sizes [edges[k], edges[k + 1])
+	std::vector<long long> bins;
+	std::vector<int> edges;
+	//number of drops of every area, duration and number of topples, drops without topples are in [0]
+	std::vector<long long> areaFreq;
+	std::vector<long long> durationFreq;
+	std::vector<long long> topplesFreq;
+	double gyrationSum;
+	//range of sizes used by fit(), the finite-size cutoff fitMax = 0 means the largest size seen
+	int fitMin;
+	int fitMax;
+	bool skipWarmup;
+	Stationarity warmup;
+	SizeStats();
+	void begin(int cells, int capacity);
+	void add(int size, const Avalanche &avalanche = Avalanche());
+	void clear();
+	int largest() const;
+	PowerLawFit fit() const;
+	static PowerLawFit fitRange(const std::vector<long long> &histogram, int min, int max);
+	static double mean(const std::vector<long long> &histogram);
+	double meanGyration() const;
+	std::vector<float> logDensity(float &low, float &high) const;
+	void writeSummary(std::ostream &os) const;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef BITPLATE_HPP
+#define BITPLATE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+//number of set bits
+inline int countBits(uint64_t x)
+{
+#if defined __GNUC__
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int) ((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+//index of the lowest set bit, x must not be 0
+inline int lowestBit(uint64_t x)
+{
+#if defined __GNUC__
+	return __builtin_ctzll(x);
+#else
+	return countBits((x & (~x + 1)) - 1);
+#endif
+}
+
+/*
+plate stored as three bit-planes of packed rows, 64 cells per word.
+heights up to 7 fit, which is enough as long as every cell starts at 7 or less:
+after a synchronous topple a cell keeps at most 3 and receives at most 4.
+*/
+class BitPlate
+{
+public:
+	int width;
+	int height;
+	BitPlate(int width, int height);
+	void load(const std::vector<std::vector<int>> &plate);
+	void store(std::vector<std::vector<int>> &plate) const;
+	bool topple();
+	long long stabilize();
+private:
+	int words;
+	uint64_t lastMask;
+	std::vector<uint64_t> planes[3];
+	std::vector<uint64_t> toppling;
+	long long topples;
+};
+
+#endif
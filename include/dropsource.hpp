@@ -0,0 +1,63 @@
+#ifndef DROPSOURCE_HPP
+#define DROPSOURCE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+//walker alias table: samples an index in proportion to its weight with one lookup
+struct AliasTable
+{
+	double total = 0.0;
+	std::vector<double> prob;
+	std::vector<int> alias;
+	void build(const std::vector<double> &weights);
+	int sample(uint32_t a, uint32_t b) const;
+};
+
+/*
+distribution of random drop sites over the plate, given as a weight per cell.
+sampling is two alias table lookups, one for the column and one for the cell in it, so changing
+a weight only rebuilds the table of its column and the small table over the column totals.
+sites are drawn batchSize at a time into a buffer, which is thrown away when the weights change.
+*/
+class DropSource
+{
+public:
+	static const int batchSize = 4096;
+	int width;
+	int height;
+	DropSource();
+	void resize(int width, int height);
+	bool empty() const;
+	double weight(int x, int y) const;
+	void setWeight(int x, int y, double weight);
+	void clear();
+	void assign(const DropSource &other);
+	void addGaussian(double cx, double cy, double sigma);
+	void addLine(double x0, double y0, double x1, double y1, double radius);
+	bool load(const std::string &path);
+	std::pair<int, int> next(std::mt19937 &rng);
+private:
+	//weights[x][y], like the plate
+	std::vector<std::vector<double>> weights;
+	std::vector<AliasTable> columns;
+	AliasTable totals;
+	std::vector<bool> dirty;
+	//number of cells with a weight above 0
+	int positive;
+	bool changed;
+	std::vector<std::pair<int, int>> buffer;
+	std::size_t used;
+	void rebuild();
+	void refill(std::mt19937 &rng);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef EXPORT_HPP
+#define EXPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "analysis.hpp"
+
+//simulation environment written next to the size data, in the order plot.R reads it
+struct SimInfo
+{
+	std::string reset;
+	int width;
+	int height;
+	int drops;
+	int centerCount;
+	int randomCount;
+};
+
+bool exportData(const std::filesystem::path &dir, const SimInfo &info, const SizeStats &stats, std::atomic<float> *progress = nullptr);
+
+//writes the data files on a background thread, one export at a time
+class DataExporter
+{
+public:
+	DataExporter();
+	~DataExporter();
+	bool start(const std::filesystem::path &dir, const SimInfo &info, SizeStats &&stats);
+	bool busy() const;
+	float progress() const;
+	bool failed() const;
+private:
+	std::thread writer;
+	std::atomic<bool> running;
+	std::atomic<bool> lastFailed;
+	std::atomic<float> written;
+};
+
+#endif
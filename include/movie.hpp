@@ -0,0 +1,60 @@
+#ifndef MOVIE_HPP
+#define MOVIE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sandpile.hpp"
+
+//a snapshot of the plate, one byte per cell in [y][x] order
+struct Frame
+{
+	int index;
+	int width;
+	int height;
+	std::vector<unsigned char> cells;
+};
+
+/*
+turns plate snapshots into a numbered png sequence on a pool of background threads.
+the simulation only copies the plate, rasterizing and compressing happen on the workers.
+*/
+class FrameEncoder
+{
+public:
+	//size of one cell in pixels
+	int scale;
+	FrameEncoder(const std::filesystem::path &dir, int scale, int threads = 0);
+	~FrameEncoder();
+	void submit(const Sandpile &pile);
+	bool finish();
+	int frames() const;
+private:
+	std::filesystem::path dir;
+	int next;
+	int maxQueued;
+	bool closing;
+	std::atomic<int> failed;
+	std::deque<Frame> queue;
+	std::vector<std::vector<unsigned char>> spare;
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable space;
+	std::vector<std::thread> workers;
+	void work();
+	void rasterize(const Frame &frame, std::vector<unsigned char> &pixels) const;
+};
+
+int runMovie(const std::string &size, const std::string &mode, const std::string &drops, const std::filesystem::path &outDir);
+
+#endif
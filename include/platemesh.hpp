@@ -0,0 +1,43 @@
+#ifndef PLATEMESH_HPP
+#define PLATEMESH_HPP
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+
+/*
+cubes of the plate, split into square chunks of cells that are drawn with one instanced call each.
+every chunk keeps its own instance buffer, which is only uploaded again when one of its cells changed,
+and a bounding box so that chunks outside of a view volume can be skipped.
+*/
+class PlateMesh
+{
+public:
+	static const int chunkSize = 32;
+	PlateMesh();
+	void update(const std::vector<std::vector<int>> &prev, const std::vector<std::vector<int>> &target);
+	int draw(const glm::mat4 &viewProjection);
+	void release();
+private:
+	struct Chunk
+	{
+		int x0, z0, x1, z1;
+		float minY, maxY;
+		int instances;
+		GLuint VAO, VBO;
+	};
+	int width;
+	int height;
+	GLuint cubeVBO;
+	std::vector<Chunk> chunks;
+	std::vector<std::vector<int>> lastPrev;
+	std::vector<std::vector<int>> lastTarget;
+	std::vector<float> instanceData;
+	void createCube();
+	void upload(Chunk &chunk, const std::vector<std::vector<int>> &prev, const std::vector<std::vector<int>> &target);
+	static bool isVisible(const Chunk &chunk, const glm::vec4 planes[6]);
+};
+
+#endif
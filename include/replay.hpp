@@ -0,0 +1,74 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "sandpile.hpp"
+#include "analysis.hpp"
+#include "varint.hpp"
+
+/*
+record of a run that can be played back from any drop. a run is fully determined by its starting plate
+and the sites of its drops, so every drop is stored as the varint coded change in x and y from the previous
+site (two bytes for centered drops), and the whole state is stored every keyframeInterval drops.
+the histograms of the statistics are only stored as the counts that changed since the previous keyframe,
+so a keyframe costs about as much as the plate and the memory doesn't grow with the largest avalanche.
+seek() restores the last keyframe before the requested drop and relaxes the drops after it in batches.
+*/
+class ReplayLog
+{
+public:
+	int keyframeInterval;
+	//number of drops the pile is at, less than length() after seeking back
+	int position;
+	ReplayLog();
+	void begin(Sandpile &pile, const SizeStats &stats);
+	void capture(Sandpile &pile, const SizeStats &stats, int centerCount, int randomCount);
+	void record(const std::vector<std::pair<int, int>> &sites, bool random);
+	int length() const;
+	std::size_t bytes() const;
+	bool seek(int drop, Sandpile &pile, SizeStats &stats, int &centerCount, int &randomCount);
+private:
+	//counts added to a histogram since the previous keyframe, by index. histograms only grow during a run
+	typedef std::vector<std::pair<int, long long>> HistogramDelta;
+	//state of the run between two drops, before the size of the last drop is added to the statistics
+	struct Keyframe
+	{
+		int drop;
+		std::size_t offset;
+		int x;
+		int y;
+		int width;
+		int height;
+		//2 bits per stable cell
+		std::vector<uint8_t> cells;
+		int size;
+		Avalanche avalanche;
+		//the statistics without their histograms and bin edges, which are stored as changes
+		SizeStats stats;
+		HistogramDelta freq;
+		HistogramDelta bins;
+		HistogramDelta areaFreq;
+		HistogramDelta durationFreq;
+		HistogramDelta topplesFreq;
+		std::vector<int> edges;
+		int centerCount;
+		int randomCount;
+	};
+	std::vector<Keyframe> keyframes;
+	std::vector<unsigned char> stream;
+	int drops;
+	int lastX;
+	int lastY;
+	//statistics at the newest keyframe, the next keyframe stores its changes against them
+	SizeStats recorded;
+	void truncate(int drop);
+	void restore(std::vector<Keyframe>::const_iterator key, SizeStats &stats) const;
+	std::size_t decode(std::size_t offset, int &x, int &y, bool &random) const;
+	std::vector<Keyframe>::const_iterator keyframeBefore(int drop) const;
+};
+
+#endif
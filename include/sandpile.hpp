@@ -1,4 +1,3 @@
-
 #ifndef SANDPILE_HPP
 #define SANDPILE_HPP
 
@@ -8,9 +7,18 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
-#include <queue>
+#include <functional>
 #include <vector>
 #include <cstring>
+#include <climits>
+#include <ctime>
+#include <random>
+#include <algorithm>
+
+#include "bitplate.hpp"
+#include "dropsource.hpp"
+#include "analysis.hpp"
+#include "workerpool.hpp"
 
 class Sandpile
 {
@@ -21,19 +29,132 @@ public:
 	int capacity;
 	int size;
 	std::vector<std::vector<int>> plate;
-	std::queue<std::pair<int, int>> affectedCells;
-	std::queue<std::pair<int, int>> collapsingCells;
-	std::queue<int> depths;
 	bool center;
-	Sandpile(int width, int height);
+	bool symmetric;
+	//worker threads for batches and large layers, 0 for one per core
+	int threads;
+	//weights of the random drop sites, uniform while it is empty or sized for another plate
+	DropSource source;
+	//where the grains of the last update() or batch were dropped
+	std::vector<std::pair<int, int>> sites;
+	//shape of the current (or last) avalanche, and of every drop of the last batch
+	Avalanche avalanche;
+	std::vector<Avalanche> avalanches;
+	Sandpile(int width, int height, unsigned int seed = time(0));
 	void update();
+	bool idle() const;
 	void fillRand();
 	void fillValue(int n);
+	void fillIdentity();
+	void fillRelaxed();
+	void stabilize();
 	void resize();
+	void syncPlate();
+	void dropBatch(int count, std::vector<int> &sizes);
+	void dropSites(const std::vector<std::pair<int, int>> &sites, std::vector<int> &sizes);
+	void setPlate(const std::vector<std::vector<int>> &cells);
 private:
+	//totals of one sweep over the layer storage
+	struct LayerSums
+	{
+		int size = 0;
+		int capacity = 0;
+		int cells = 0;
+		int first = INT_MAX;
+		int last = -1;
+		int firstWord = INT_MAX;
+		int lastWord = -1;
+		long long topples = 0;
+		int area = 0;
+		long long sumX = 0;
+		long long sumY = 0;
+		long long sumSquares = 0;
+	};
+	//result of relaxing one drop against a fixed plate, without writing to it
+	struct Speculation
+	{
+		int size;
+		Avalanche avalanche;
+		std::vector<int> touched;
+		std::vector<int> values;
+	};
+	//per-thread copy-on-read overlay of the plate, the fields of a cell are kept together for locality
+	struct OverlayCell
+	{
+		//generation in which the cell was read, and in which it toppled
+		int stamp = 0;
+		int visited = 0;
+		int value = 0;
+	};
+	struct Overlay
+	{
+		int generation = 0;
+		std::vector<OverlayCell> cells;
+		std::vector<int> wave;
+		std::vector<int> next;
+		std::vector<int> topples;
+	};
 	int currentDepth;
-	void dropOne(int x, int y, int depth, bool collapse);
-	void resetQueues();
+	std::mt19937 rng;
+	//layer-by-layer relaxation state, one bit or count per cell of the plate (or of the wedge)
+	static const int parallelWork = 1 << 14;
+	int layerRows, layerStride;
+	int frontierCells, collapsingCells;
+	//rows, and words within the rows, that hold any frontier or collapsing cells
+	int frontierFirst, frontierLast;
+	int frontierFirstWord, frontierLastWord;
+	int collapsingFirst, collapsingLast;
+	int collapsingFirstWord, collapsingLastWord;
+	std::vector<uint64_t> frontier;
+	std::vector<uint64_t> collapsing;
+	//the same cells as a list, filled by the serial passes so that small layers don't scan rows. only valid while listed
+	std::vector<std::pair<int, int>> frontierList;
+	std::vector<std::pair<int, int>> collapsingList;
+	bool frontierListed, collapsingListed;
+	std::vector<int> incoming;
+	std::vector<int> toppled;
+	//cells that toppled in the current avalanche are stamped with its generation, so nothing is cleared between drops
+	std::vector<int> visited;
+	int visitGeneration;
+	//symmetry-reduced storage, only used while dropping in the center
+	bool reduced;
+	bool plateStale;
+	//the plate wasn't invariant when it was last checked, so it isn't checked again before the next fill
+	bool foldFailed;
+	bool foldX, foldY, foldDiag;
+	int wedgeWidth, wedgeHeight;
+	std::vector<int> wedge;
+	std::vector<int> wedgeWeight;
+	std::vector<int> edgeStart;
+	std::vector<int> edgeTarget;
+	std::vector<std::pair<int, int>> wedgeCells;
+	//sums of x, y and x^2 + y^2 over the orbit of every wedge cell
+	std::vector<long long> orbitX;
+	std::vector<long long> orbitY;
+	std::vector<long long> orbitSquares;
+	std::vector<Overlay> overlays;
+	std::vector<int> claimed;
+	int batchGeneration;
+	std::pair<int, int> nextDropSite();
+	int workerCount() const;
+	bool serialWork(int work) const;
+	void speculate(int x, int y, Overlay &overlay, Speculation &result) const;
+	void commit(const Speculation &result);
+	void settleCollapsing();
+	bool toppleCell(int i, int j, LayerSums &sums);
+	void toppleFrontier();
+	void receive(int row, int column, int grains, int weight, LayerSums &sums);
+	void setFrontier(const LayerSums &total, bool listed);
+	void gatherPlate();
+	void gatherWedge();
+	template <typename Sweep>
+	LayerSums sweepRows(int first, int last, int work, const Sweep &sweep);
+	void resetFrontier();
+	int wedgeIndex(int x, int y) const;
+	void buildWedge();
+	bool foldPlate();
+	void unfoldPlate();
+	void releaseWedge();
 };
 
-#endif
\ No newline at end of file
+#endif
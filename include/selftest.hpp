@@ -0,0 +1,23 @@
+#ifndef SELFTEST_HPP
+#define SELFTEST_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sandpile.hpp"
+#include "bitplate.hpp"
+
+/*
+checks that the fast engines give exactly the same results as the plain sequential ones, and times them:
+	sandpile --selftest [drops]
+prints one line per check or measurement, and returns 1 if any check failed.
+*/
+int runSelftest(const std::string &drops);
+
+#endif
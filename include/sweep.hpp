@@ -0,0 +1,40 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sandpile.hpp"
+#include "export.hpp"
+
+//one configuration of a parameter sweep
+struct SweepJob
+{
+	int width;
+	int height;
+	bool center;
+	std::string fill;
+	bool skipWarmup;
+	int drops;
+	//seed of the whole spec, the job's own seed() is derived from it
+	unsigned int baseSeed;
+	std::string name() const;
+	unsigned int seed() const;
+	long long cost() const;
+};
+
+std::vector<SweepJob> readSweepSpec(const std::string &path);
+int runSweep(const std::string &specPath, const std::filesystem::path &outDir);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sandpile.hpp"
+#include "analysis.hpp"
+#include "varint.hpp"
+
+/*
+streams the state of a running sandpile to any number of clients on a unix domain socket.
+every message is a type byte, 'K' (keyframe) or 'D' (delta), then the varint length of the payload:
+	width, height, drops, avalanches (drops that lost grains), capacity, size, drops per second
+	histogram: number of entries, then (size - previous size, signed change in count) per entry
+	cells: keyframe: width * height values, delta: number of changed cells, then (index - previous index, value)
+cells are indexed x * height + y. a keyframe holds the whole histogram and plate, a delta what changed since
+the previous message. new clients start with a keyframe.
+all sockets are non-blocking: output that a client doesn't take is queued, and a client that falls
+more than maxPending bytes behind is dropped, so the simulation never waits for a client.
+*/
+class TelemetryServer
+{
+public:
+	//seconds between messages
+	double interval;
+	static const std::size_t maxPending = 1 << 22;
+	TelemetryServer();
+	~TelemetryServer();
+	bool start(const std::string &path);
+	void stop();
+	bool running() const;
+	void publish(Sandpile &pile, const SizeStats &stats);
+private:
+	struct Client
+	{
+		int fd;
+		bool synced;
+		std::vector<unsigned char> pending;
+		std::size_t sent;
+	};
+	int listener;
+	std::string path;
+	std::vector<Client> clients;
+	std::chrono::steady_clock::time_point lastTime;
+	//state as of the last message, the base of the next delta
+	bool haveBase;
+	int lastWidth;
+	int lastHeight;
+	int lastDrops;
+	std::vector<int> lastCells;
+	std::vector<long long> lastFreq;
+	void acceptClients();
+	bool flush(Client &client);
+	void closeClient(Client &client);
+	void header(std::vector<unsigned char> &payload, const Sandpile &pile, const SizeStats &stats, long long rate) const;
+};
+
+#endif
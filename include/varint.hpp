@@ -0,0 +1,55 @@
+#ifndef VARINT_HPP
+#define VARINT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+//append x in 7 bit groups, lowest first, the high bit marks that more groups follow
+inline void putVarint(std::vector<unsigned char> &out, uint64_t x)
+{
+	while (x >= 0x80) {
+		out.push_back((unsigned char) (x | 0x80));
+		x >>= 7;
+	}
+	out.push_back((unsigned char) x);
+}
+
+//map signed values to unsigned ones, so small negative numbers stay short: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+inline uint64_t zigzag(int64_t x)
+{
+	return ((uint64_t) x << 1) ^ (uint64_t) (x >> 63);
+}
+
+inline int64_t unzigzag(uint64_t x)
+{
+	return (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+}
+
+inline void putSigned(std::vector<unsigned char> &out, int64_t x)
+{
+	putVarint(out, zigzag(x));
+}
+
+//read a varint at pos and move pos past it
+inline uint64_t getVarint(const unsigned char *data, std::size_t size, std::size_t &pos)
+{
+	uint64_t x = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (pos >= size)
+			throw std::runtime_error("truncated varint");
+		unsigned char byte = data[pos++];
+		x |= (uint64_t) (byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return x;
+	}
+	throw std::runtime_error("bad varint");
+}
+
+inline int64_t getSigned(const unsigned char *data, std::size_t size, std::size_t &pos)
+{
+	return unzigzag(getVarint(data, size, pos));
+}
+
+#endif
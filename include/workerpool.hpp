@@ -0,0 +1,38 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+threads that are started once and then kept waiting for work, so a job split over the cores
+doesn't pay for starting threads every time (the layers of an avalanche are far too short for that).
+run() blocks until every task is done, the calling thread works on the tasks as well.
+only one job runs at a time: a job started while another one is running runs on its caller alone.
+*/
+class WorkerPool
+{
+public:
+	static WorkerPool &shared();
+	~WorkerPool();
+	void run(int tasks, const std::function<void(int)> &task);
+private:
+	std::mutex running;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::vector<std::thread> threads;
+	const std::function<void(int)> *job = nullptr;
+	int next = 0;
+	int total = 0;
+	int remaining = 0;
+	long long generation = 0;
+	bool stopping = false;
+	void work(long long seen);
+	void runTasks(std::unique_lock<std::mutex> &lock);
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include "analysis.hpp"
+
+Stationarity::Stationarity()
+	: tolerance(0.05)
+{
+	reset(1, 0);
+}
+
+//start over on a plate of cells cells holding capacity grains
+void Stationarity::reset(int cells, int capacity)
+{
+	this->cells = std::max(cells, 1);
+	this->capacity = capacity;
+	window = std::max(256, cells);
+	since = -1;
+	meanHeight = (double) capacity / this->cells;
+	outflow = 0.0;
+	sizeMean = 0.0;
+	sizeError = 0.0;
+	drops = 0;
+	windowCapacity = capacity;
+	count = 0;
+	sum = 0.0;
+	sumSquares = 0.0;
+	havePrevious = false;
+}
+
+//add the size of a finished drop, returns whether the run was already stationary before it
+bool Stationarity::add(int size)
+{
+	bool before = stationary();
+	drops++;
+	capacity += 1 - size;
+	meanHeight = (double) capacity / cells;
+	count++;
+	sum += size;
+	sumSquares += (double) size * size;
+	if (count < window)
+		return before;
+
+	double mean = sum / count;
+	double error = std::sqrt(std::max(0.0, sumSquares / count - mean * mean) / count);
+	double drift = (double) (capacity - windowCapacity) / cells;
+	//two windows agree if their means are within three standard errors
+	bool agrees = havePrevious && std::fabs(mean - sizeMean) <= 3.0 * std::sqrt(error * error + sizeError * sizeError);
+	if (!before && agrees && std::fabs(drift) < tolerance)
+		since = drops;
+	outflow = mean;
+	sizeMean = mean;
+	sizeError = error;
+	havePrevious = true;
+	windowCapacity = capacity;
+	count = 0;
+	sum = 0.0;
+	sumSquares = 0.0;
+	return before;
+}
+
+bool Stationarity::stationary() const
+{
+	return since >= 0;
+}
+
+//root mean square distance of the toppled cells from their center
+double Avalanche::gyration() const
+{
+	if (area == 0)
+		return 0.0;
+	double x = (double) sumX / area, y = (double) sumY / area;
+	return std::sqrt(std::max(0.0, (double) sumSquares / area - x * x - y * y));
+}
+
+//count value in a histogram indexed by value
+static void count(std::vector<long long> &histogram, long long value)
+{
+	if (value >= (long long) histogram.size())
+		histogram.resize(value + 1, 0);
+	histogram[value]++;
+}
+
+SizeStats::SizeStats()
+{
+	fitMin = 1;
+	fitMax = 0;
+	skipWarmup = false;
+	clear();
+}
+
+//start a new run on a plate of cells cells holding capacity grains
+void SizeStats::begin(int cells, int capacity)
+{
+	clear();
+	warmup.reset(cells, capacity);
+}
+
+void SizeStats::add(int size, const Avalanche &avalanche)
+{
+	if (!warmup.add(size) && skipWarmup) {
+		skipped++;
+		return;
+	}
+	drops++;
+	count(freq, size);
+	count(areaFreq, avalanche.area);
+	count(durationFreq, avalanche.duration);
+	count(topplesFreq, avalanche.topples);
+	gyrationSum += avalanche.gyration();
+	if (size < 1)
+		return;
+	//add bins up to the one holding size, each about a quarter octave wide
+	while (edges.back() <= size) {
+		int next = (int) std::lround(edges.back() * std::exp2(1.0 / binsPerOctave));
+		edges.push_back(std::max(next, edges.back() + 1));
+		bins.push_back(0);
+	}
+	bins[std::upper_bound(edges.begin(), edges.end(), size) - edges.begin() - 1]++;
+}
+
+void SizeStats::clear()
+{
+	drops = 0;
+	skipped = 0;
+	freq.clear();
+	areaFreq.clear();
+	durationFreq.clear();
+	topplesFreq.clear();
+	gyrationSum = 0.0;
+	bins.clear();
+	edges.assign(1, 1);
+}
+
+int SizeStats::largest() const
+{
+	return (int) freq.size() - 1;
+}
+
+/*
+discrete power law truncated to [min, max], p(s) = s^-alpha / Z(alpha) with Z the sum of s^-alpha over the range.
+the likelihood is largest where the model's mean of ln(s) equals the observed one. that mean falls as alpha grows
+and its derivative is minus the variance of ln(s), so a few newton steps find alpha. the error is 1 / sqrt(fisher information).
+*/
+PowerLawFit SizeStats::fitRange(const std::vector<long long> &histogram, int min, int max)
+{
+	int top = (int) histogram.size() - 1;
+	PowerLawFit result = {false, 0.0, 0.0, std::max(min, 1), (max > 0) ? std::min(max, top) : top, 0};
+	if (result.max <= result.min)
+		return result;
+
+	double observed = 0.0;
+	for (int s = result.min; s <= result.max; s++) {
+		observed += histogram[s] * std::log((double) s);
+		result.samples += histogram[s];
+	}
+	if (result.samples < 2)
+		return result;
+	observed /= result.samples;
+
+	std::vector<double> logs(result.max - result.min + 1);
+	for (int s = result.min; s <= result.max; s++)
+		logs[s - result.min] = std::log((double) s);
+
+	//the mean is strictly between ln(min) and ln(max) only if the sizes are not all at one end
+	if (observed <= logs.front() + 1e-12 || observed >= logs.back() - 1e-12)
+		return result;
+
+	double alpha = 1.5, low = -20.0, high = 20.0, variance = 0.0;
+	for (int i = 0; i < 100; i++) {
+		double z = 0.0, mean = 0.0, square = 0.0;
+		for (double l : logs) {
+			double p = std::exp(-alpha * (l - logs.front()));
+			z += p;
+			mean += p * l;
+			square += p * l * l;
+		}
+		mean /= z;
+		variance = square / z - mean * mean;
+		if (mean > observed)
+			low = alpha;
+		else
+			high = alpha;
+		double next = alpha + (mean - observed) / variance;
+		//fall back to bisection if newton leaves the bracket
+		if (!(next > low && next < high))
+			next = 0.5 * (low + high);
+		if (std::fabs(next - alpha) < 1e-9) {
+			alpha = next;
+			break;
+		}
+		alpha = next;
+	}
+	result.valid = variance > 0.0;
+	result.alpha = alpha;
+	result.error = result.valid ? 1.0 / std::sqrt(result.samples * variance) : 0.0;
+	return result;
+}
+
+//fit of the sizes within fitMin..fitMax
+PowerLawFit SizeStats::fit() const
+{
+	return fitRange(freq, fitMin, fitMax);
+}
+
+//mean value of a histogram indexed by value
+double SizeStats::mean(const std::vector<long long> &histogram)
+{
+	double sum = 0.0;
+	long long n = 0;
+	for (std::size_t v = 0; v < histogram.size(); v++) {
+		sum += (double) v * histogram[v];
+		n += histogram[v];
+	}
+	return (n > 0) ? sum / n : 0.0;
+}
+
+//mean radius of gyration of the avalanches that toppled anything
+double SizeStats::meanGyration() const
+{
+	long long toppling = drops - (areaFreq.empty() ? 0 : areaFreq[0]);
+	return (toppling > 0) ? gyrationSum / toppling : 0.0;
+}
+
+/*
+log10 of the probability density of every bin, for plotting against the log of the size.
+empty bins are set to low, the smallest density, high is the largest.
+*/
+std::vector<float> SizeStats::logDensity(float &low, float &high) const
+{
+	std::vector<float> density(bins.size());
+	low = 0.0f;
+	high = 0.0f;
+	bool first = true;
+	for (std::size_t k = 0; k < bins.size(); k++) {
+		if (bins[k] == 0)
+			continue;
+		density[k] = (float) std::log10((double) bins[k] / (edges[k + 1] - edges[k]) / drops);
+		low = first ? density[k] : std::min(low, density[k]);
+		high = first ? density[k] : std::max(high, density[k]);
+		first = false;
+	}
+	for (std::size_t k = 0; k < bins.size(); k++)
+		if (bins[k] == 0)
+			density[k] = low;
+	return density;
+}
+
+//compact summary: the fit and the log-binned distribution, one tab separated row per bin
+void SizeStats::writeSummary(std::ostream &os) const
+{
+	PowerLawFit f = fit();
+	os << "drops\t" << drops << "\n"
+	   << "skipped\t" << skipped << "\n"
+	   << "stationary\t" << warmup.since << "\n"
+	   << "zero\t" << (freq.empty() ? 0 : freq[0]) << "\n"
+	   << "largest\t" << std::max(largest(), 0) << "\n"
+	   << "fitMin\t" << f.min << "\n"
+	   << "fitMax\t" << f.max << "\n"
+	   << "fitDrops\t" << f.samples << "\n";
+	if (f.valid)
+		os << "alpha\t" << f.alpha << "\n"
+		   << "error\t" << f.error << "\n";
+	else
+		os << "alpha\tNA\n"
+		   << "error\tNA\n";
+	//the other measures are fitted from fitMin up to their largest value
+	const std::pair<const char *, const std::vector<long long> *> measures[] = {
+		{"area", &areaFreq}, {"duration", &durationFreq}, {"topples", &topplesFreq}
+	};
+	for (const auto &measure : measures) {
+		PowerLawFit m = fitRange(*measure.second, fitMin, 0);
+		os << measure.first << "Mean\t" << mean(*measure.second) << "\n";
+		if (m.valid)
+			os << measure.first << "Alpha\t" << m.alpha << "\n"
+			   << measure.first << "Error\t" << m.error << "\n";
+		else
+			os << measure.first << "Alpha\tNA\n"
+			   << measure.first << "Error\tNA\n";
+	}
+	os << "gyrationMean\t" << meanGyration() << "\n";
+	os << "\nStart\tEnd\tCount\tDensity\n";
+	for (std::size_t k = 0; k < bins.size(); k++)
+		os << edges[k] << "\t" << edges[k + 1] - 1 << "\t" << bins[k] << "\t" << (double) bins[k] / (edges[k + 1] - edges[k]) / drops << "\n";
+}
@@ -0,0 +1,111 @@
+#include "bitplate.hpp"
+
+BitPlate::BitPlate(int width, int height)
+	: width(width), height(height), topples(0)
+{
+	//rows run along the first plate index, one row per second index
+	words = (width + 63) / 64;
+	lastMask = (width % 64 == 0) ? ~0ULL : (1ULL << (width % 64)) - 1;
+	for (std::vector<uint64_t> &plane : planes)
+		plane.assign(words * height, 0);
+	toppling.assign(words * height, 0);
+}
+
+void BitPlate::load(const std::vector<std::vector<int>> &plate)
+{
+	for (std::vector<uint64_t> &plane : planes)
+		std::fill(plane.begin(), plane.end(), 0);
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			int n = plate[i][j];
+			if (n < 0 || n > 7)
+				throw std::invalid_argument("height does not fit in 3 bits!");
+			for (int b = 0; b < 3; b++)
+				if (n & (1 << b))
+					planes[b][j * words + i / 64] |= 1ULL << (i % 64);
+		}
+	}
+	topples = 0;
+}
+
+void BitPlate::store(std::vector<std::vector<int>> &plate) const
+{
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			int n = 0;
+			for (int b = 0; b < 3; b++)
+				n |= (int) ((planes[b][j * words + i / 64] >> (i % 64)) & 1) << b;
+			plate[i][j] = n;
+		}
+	}
+}
+
+/*
+topple every cell with n >= 4 once, simultaneously.
+the toppling mask is the top plane. each cell keeps its two low bits (n - 4 when it topples)
+and gets the number of toppling neighbours added with bitwise adders, 64 cells at a time.
+returns whether anything toppled.
+*/
+bool BitPlate::topple()
+{
+	toppling = planes[2];
+	//only rows next to a toppling row can change
+	int first = height, last = -1;
+	for (int j = 0; j < height; j++) {
+		for (int k = 0; k < words; k++) {
+			if (toppling[j * words + k] != 0) {
+				first = std::min(first, j);
+				last = j;
+				break;
+			}
+		}
+	}
+	if (last < 0)
+		return false;
+
+	for (int j = std::max(0, first - 1); j <= std::min(height - 1, last + 1); j++) {
+		const uint64_t *row = &toppling[j * words];
+		const uint64_t *up = (j > 0) ? &toppling[(j - 1) * words] : nullptr;
+		const uint64_t *down = (j < height - 1) ? &toppling[(j + 1) * words] : nullptr;
+		for (int k = 0; k < words; k++) {
+			uint64_t t = row[k];
+			//neighbours along the row, carrying across word boundaries
+			uint64_t a = (t << 1) | ((k > 0) ? row[k - 1] >> 63 : 0);
+			uint64_t b = (t >> 1) | ((k < words - 1) ? row[k + 1] << 63 : 0);
+			uint64_t c = (up) ? up[k] : 0;
+			uint64_t d = (down) ? down[k] : 0;
+			uint64_t mask = (k == words - 1) ? lastMask : ~0ULL;
+			a &= mask;
+			if ((t | a | b | c | d) == 0)
+				continue;
+
+			topples += countBits(t);
+
+			//count = a + b + c + d, as three bits s0, s1, s2
+			uint64_t ab = a ^ b, abCarry = a & b;
+			uint64_t cd = c ^ d, cdCarry = c & d;
+			uint64_t s0 = ab ^ cd, lowCarry = ab & cd;
+			uint64_t s1 = abCarry ^ cdCarry ^ lowCarry;
+			uint64_t s2 = (abCarry & cdCarry) | (lowCarry & (abCarry ^ cdCarry));
+
+			//low two bits + count, at most 3 + 4
+			uint64_t *b0 = &planes[0][j * words + k];
+			uint64_t *b1 = &planes[1][j * words + k];
+			uint64_t *b2 = &planes[2][j * words + k];
+			uint64_t r0 = *b0 ^ s0, k0 = *b0 & s0;
+			uint64_t r1 = *b1 ^ s1 ^ k0, k1 = (*b1 & s1) | (k0 & (*b1 ^ s1));
+			*b0 = r0;
+			*b1 = r1;
+			*b2 = s2 ^ k1;
+		}
+	}
+	return true;
+}
+
+//topple until stable, returning the number of topples
+long long BitPlate::stabilize()
+{
+	long long start = topples;
+	while (topple());
+	return topples - start;
+}
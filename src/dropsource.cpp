@@ -0,0 +1,218 @@
+#include "dropsource.hpp"
+
+/*
+vose's method: scale the weights so they average 1, then repeatedly pair an index below 1 with one above 1.
+the small one keeps its own probability and gives the rest of its slot to the large one.
+*/
+void AliasTable::build(const std::vector<double> &weights)
+{
+	int n = (int) weights.size();
+	total = 0.0;
+	for (double w : weights)
+		total += w;
+	prob.assign(n, 1.0);
+	alias.resize(n);
+	for (int i = 0; i < n; i++)
+		alias[i] = i;
+	if (total <= 0.0)
+		return;
+
+	std::vector<double> scaled(n);
+	std::vector<int> small, large;
+	for (int i = 0; i < n; i++) {
+		scaled[i] = weights[i] * n / total;
+		if (scaled[i] < 1.0)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		prob[s] = scaled[s];
+		alias[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	//whatever is left is 1 up to rounding
+	for (int i : small)
+		prob[i] = 1.0;
+	for (int i : large)
+		prob[i] = 1.0;
+}
+
+//a picks the slot, b decides between the slot and its alias
+int AliasTable::sample(uint32_t a, uint32_t b) const
+{
+	int i = (int) (((uint64_t) a * prob.size()) >> 32);
+	return (b * (1.0 / 4294967296.0) < prob[i]) ? i : alias[i];
+}
+
+DropSource::DropSource()
+	: width(0), height(0), positive(0), changed(false), used(0)
+{
+}
+
+//all weights become 0
+void DropSource::resize(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	weights.assign(width, std::vector<double>(height, 0.0));
+	columns.assign(width, AliasTable());
+	dirty.assign(width, true);
+	positive = 0;
+	changed = true;
+}
+
+//checked before every random drop, so it only looks at the count of cells with weight
+bool DropSource::empty() const
+{
+	return positive == 0;
+}
+
+double DropSource::weight(int x, int y) const
+{
+	return weights[x][y];
+}
+
+void DropSource::setWeight(int x, int y, double weight)
+{
+	weight = std::max(weight, 0.0);
+	if (x < 0 || x >= width || y < 0 || y >= height || weights[x][y] == weight)
+		return;
+	positive += (weight > 0.0) - (weights[x][y] > 0.0);
+	weights[x][y] = weight;
+	dirty[x] = true;
+	changed = true;
+}
+
+void DropSource::clear()
+{
+	resize(width, height);
+}
+
+//take over the weights of other. on a source of the same size, only the columns whose weights differ are rebuilt
+void DropSource::assign(const DropSource &other)
+{
+	if (other.width != width || other.height != height)
+		resize(other.width, other.height);
+	for (int x = 0; x < width; x++)
+		for (int y = 0; y < height; y++)
+			setWeight(x, y, other.weights[x][y]);
+}
+
+//add a normal distribution around (cx, cy), its weights sum to about 1
+void DropSource::addGaussian(double cx, double cy, double sigma)
+{
+	sigma = std::max(sigma, 0.1);
+	const double pi = 3.14159265358979323846;
+	double norm = 1.0 / (2.0 * pi * sigma * sigma);
+	for (int x = 0; x < width; x++) {
+		for (int y = 0; y < height; y++) {
+			double dx = x - cx, dy = y - cy;
+			setWeight(x, y, weights[x][y] + norm * std::exp(-(dx * dx + dy * dy) / (2.0 * sigma * sigma)));
+		}
+	}
+}
+
+//add weight 1 to every cell within radius of the segment from (x0, y0) to (x1, y1)
+void DropSource::addLine(double x0, double y0, double x1, double y1, double radius)
+{
+	double dx = x1 - x0, dy = y1 - y0;
+	double length = dx * dx + dy * dy;
+	for (int x = 0; x < width; x++) {
+		for (int y = 0; y < height; y++) {
+			//distance to the closest point of the segment
+			double t = (length > 0.0) ? std::max(0.0, std::min(1.0, ((x - x0) * dx + (y - y0) * dy) / length)) : 0.0;
+			double ex = x0 + t * dx - x, ey = y0 + t * dy - y;
+			if (ex * ex + ey * ey <= radius * radius)
+				setWeight(x, y, weights[x][y] + 1.0);
+		}
+	}
+}
+
+/*
+load a weight map: one line per row of the plate, whitespace separated non-negative numbers.
+a map of a different size is stretched over the plate.
+*/
+bool DropSource::load(const std::string &path)
+{
+	std::ifstream fs(path);
+	if (!fs) {
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	std::vector<std::vector<double>> map;
+	std::string line;
+	while (std::getline(fs, line)) {
+		std::istringstream values(line);
+		std::vector<double> row;
+		double w;
+		while (values >> w) {
+			if (w < 0.0 || !std::isfinite(w)) {
+				std::cerr << "Bad weight " << w << " in " << path << std::endl;
+				return false;
+			}
+			row.push_back(w);
+		}
+		if (!values.eof()) {
+			std::cerr << "Bad weight in " << path << ": " << line << std::endl;
+			return false;
+		}
+		if (!row.empty())
+			map.push_back(row);
+	}
+	if (map.empty()) {
+		std::cerr << path << " has no weights" << std::endl;
+		return false;
+	}
+	for (int x = 0; x < width; x++) {
+		for (int y = 0; y < height; y++) {
+			const std::vector<double> &row = map[(std::size_t) y * map.size() / height];
+			setWeight(x, y, row[std::min((std::size_t) x * row.size() / width, row.size() - 1)]);
+		}
+	}
+	return true;
+}
+
+std::pair<int, int> DropSource::next(std::mt19937 &rng)
+{
+	if (changed)
+		rebuild();
+	if (used == buffer.size())
+		refill(rng);
+	return buffer[used++];
+}
+
+//rebuild the tables of the changed columns and the table over the column totals
+void DropSource::rebuild()
+{
+	std::vector<double> sums(width);
+	for (int x = 0; x < width; x++) {
+		if (dirty[x]) {
+			columns[x].build(weights[x]);
+			dirty[x] = false;
+		}
+		sums[x] = columns[x].total;
+	}
+	totals.build(sums);
+	changed = false;
+	//the buffered sites were drawn from the old weights
+	buffer.clear();
+	used = 0;
+}
+
+void DropSource::refill(std::mt19937 &rng)
+{
+	buffer.resize(batchSize);
+	for (std::pair<int, int> &site : buffer) {
+		uint32_t a = rng(), b = rng(), c = rng(), d = rng();
+		int x = totals.sample(a, b);
+		site = {x, columns[x].sample(c, d)};
+	}
+	used = 0;
+}
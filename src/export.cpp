@@ -0,0 +1,154 @@
+#include "export.hpp"
+
+//write to a temporary file next to path, it is only moved over path by commitFiles once every file is complete
+static bool writeTemp(const std::filesystem::path &path, const std::function<void(std::ofstream&)> &write)
+{
+	std::filesystem::path temp = path;
+	temp += ".tmp";
+	std::ofstream fs(temp, std::ios::out | std::ios::trunc);
+	if (!fs) {
+		std::cerr << "Could not open the output file." << std::endl;
+		return false;
+	}
+	write(fs);
+	fs.close();
+	if (!fs) {
+		std::cerr << "Could not write " << temp.string() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//rename the temporary files over the real ones, or remove them all if one of them could not be written
+static bool commitFiles(const std::vector<std::filesystem::path> &paths, bool written)
+{
+	std::error_code ec;
+	for (const std::filesystem::path &path : paths) {
+		std::filesystem::path temp = path;
+		temp += ".tmp";
+		if (written) {
+			std::filesystem::rename(temp, path, ec);
+			if (ec) {
+				std::cerr << "Could not replace " << path.string() << ": " << ec.message() << std::endl;
+				written = false;
+			}
+		}
+		if (!written)
+			std::filesystem::remove(temp, ec);
+	}
+	return written;
+}
+
+/*
+write asp_simInfo.txt, asp_freqDist.txt, asp_shapeDist.txt and asp_summary.txt into dir. all four are written to temporary files
+first and only replace the old ones once all of them are complete, so plot.R never reads a half-written file.
+every file carries the same export stamp, so files left over from different exports (if the renames themselves are interrupted)
+can be told apart: plot.R refuses to plot them. progress, if given, goes from 0 to 1 as the distributions are written.
+*/
+bool exportData(const std::filesystem::path &dir, const SimInfo &info, const SizeStats &stats, std::atomic<float> *progress)
+{
+	static std::atomic<int> exports(0);
+	std::string stamp = std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count()) + "-" + std::to_string(exports++);
+	std::vector<std::filesystem::path> paths = {
+		dir / "asp_freqDist.txt", dir / "asp_shapeDist.txt", dir / "asp_simInfo.txt", dir / "asp_summary.txt"
+	};
+	auto at = [](const std::vector<long long> &histogram, std::size_t value) {
+		return (value < histogram.size()) ? histogram[value] : 0;
+	};
+	std::size_t length = std::max({stats.areaFreq.size(), stats.durationFreq.size(), stats.topplesFreq.size()});
+	//one step per bucket of both distributions, empty buckets included
+	float steps = std::max<std::size_t>(stats.freq.size() + length, 1);
+	bool ok = writeTemp(paths[0], [&](std::ofstream &fs) {
+		fs << "# export " << stamp << "\n";
+		fs << "\tSize\tFreq.\n";
+		int row = 0;
+		for (std::size_t size = 0; size < stats.freq.size(); size++) {
+			if (progress && (size & 1023) == 0)
+				*progress = size / steps;
+			if (stats.freq[size] == 0)
+				continue;
+			row++;
+			fs << row << "\t" << size << "\t" << stats.freq[size] << "\n";
+		}
+	});
+	//number of drops with every value of area, duration and topples, rows where all three are 0 are left out
+	ok = ok && writeTemp(paths[1], [&](std::ofstream &fs) {
+		fs << "# export " << stamp << "\n";
+		fs << "\tValue\tArea\tDuration\tTopples\n";
+		int row = 0;
+		for (std::size_t value = 0; value < length; value++) {
+			if (progress && (value & 1023) == 0)
+				*progress = (stats.freq.size() + value) / steps;
+			long long area = at(stats.areaFreq, value), duration = at(stats.durationFreq, value), topples = at(stats.topplesFreq, value);
+			if (area == 0 && duration == 0 && topples == 0)
+				continue;
+			row++;
+			fs << row << "\t" << value << "\t" << area << "\t" << duration << "\t" << topples << "\n";
+		}
+	});
+	//store the simulation environment data in a separate file, the stamp goes last since plot.R reads the lines by number
+	ok = ok && writeTemp(paths[2], [&](std::ofstream &fs) {
+		fs << info.reset << "\n"
+		   << info.width << "\n"
+		   << info.height << "\n"
+		   << info.drops << "\n"
+		   << info.centerCount << "\n"
+		   << info.randomCount << "\n"
+		   << stamp << "\n";
+	});
+	ok = ok && writeTemp(paths[3], [&](std::ofstream &fs) {
+		fs << "export\t" << stamp << "\n";
+		stats.writeSummary(fs);
+	});
+	ok = commitFiles(paths, ok);
+	if (progress)
+		*progress = 1.0f;
+	return ok;
+}
+
+DataExporter::DataExporter()
+{
+	running = false;
+	lastFailed = false;
+	written = 0.0f;
+}
+
+DataExporter::~DataExporter()
+{
+	if (writer.joinable())
+		writer.join();
+}
+
+//hand a snapshot of the data to the writer thread, returns false if the last export is still running
+bool DataExporter::start(const std::filesystem::path &dir, const SimInfo &info, SizeStats &&stats)
+{
+	if (running)
+		return false;
+	if (writer.joinable())
+		writer.join();
+	running = true;
+	written = 0.0f;
+	writer = std::thread([this, dir, info, stats = std::move(stats)]() {
+		lastFailed = !exportData(dir, info, stats, &written);
+		running = false;
+	});
+	return true;
+}
+
+bool DataExporter::busy() const
+{
+	return running;
+}
+
+//fraction of the current export that is written
+float DataExporter::progress() const
+{
+	return written;
+}
+
+//whether the last finished export failed
+bool DataExporter::failed() const
+{
+	return lastFailed;
+}
@@ -18,13 +18,21 @@
 
 #if defined _WIN64 || defined _WIN32
 #include <windows.h>
-#elif
+#else
+#include <climits>
 #include <unistd.h>
 #endif
 
 #include "shader.hpp"
 #include "camera.hpp"
 #include "sandpile.hpp"
+#include "export.hpp"
+#include "sweep.hpp"
+#include "platemesh.hpp"
+#include "movie.hpp"
+#include "telemetry.hpp"
+#include "replay.hpp"
+#include "selftest.hpp"
 #include "stb_image.h"
 
 //screen dimensions
@@ -40,8 +48,11 @@ float lastX = screenWidth / 2.0;
 float lastY = screenHeight / 2.0;
 bool mouseMoved = false;
 
+//light space of the shadow map, also used to cull chunks in the depth pass
+glm::mat4 lightSpaceMatrix;
+
 //GUI variables
-bool pause = true;
+bool paused = true;
 bool mouseFocused = true;
 bool highlight = false;
 bool infinite = true;
@@ -56,22 +67,58 @@ int tempPlateHeight = 20;
 unsigned int playTexture;
 unsigned int pauseTexture;
 
-unsigned int cubeVAO = 0;
-unsigned int cubeVBO = 0;
 unsigned int plateVAO;
+PlateMesh plateMesh;
 
 //animation info for render function, 1 is no animation
 int animationFrames = 5;
 std::vector<std::vector<int>> plateImage;
 int currentFrame = 0;
+//milliseconds per frame spent on updates when there is no animation
+float stepBudget = 12.0f;
 const int maxFPS = 60;
 const int msPerFrame = (int) (((double) 1 / (double) maxFPS) * 1000);
+//number of random drops relaxed together while display is off
+const int dropBatchSize = 256;
+
+//what changed since the last drawn frame; nothing is drawn if nothing changed
+bool plateChanged = true;
+bool cameraChanged = true;
+bool windowChanged = true;
+//the GUI is redrawn for a few frames after any input, so that it can react to it
+int guiFrames = 0;
+const int guiSettleFrames = 3;
 
 //temp variables for GUI to store reference to
 int plateWidth, plateHeight;
 
+//ways to refill the plate on reset
+enum Reset_Fill
+{
+	CLEAR,
+	RANDOMIZE,
+	IDENTITY,
+	RELAXED
+};
+
+//where random drops land, the weight map is read from asp_weights.txt
+enum Drop_Source
+{
+	UNIFORM,
+	GAUSSIAN,
+	LINE,
+	WEIGHT_MAP
+};
+int dropSource = UNIFORM;
+//standard deviation of the gaussian and direction of the line, relative to the plate
+float sourceSpread = 0.15f;
+float sourceAngle = 0.0f;
+
 //data tracking
-std::vector<int> sizeData;
+SizeStats sizeStats;
+DataExporter exporter;
+TelemetryServer telemetry;
+ReplayLog replay;
 std::string lastReset = "cleared";
 int centerCount = 0;
 int randomCount = 0;
@@ -79,17 +126,37 @@ int randomCount = 0;
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+void window_refresh_callback(GLFWwindow *window);
 void processInput(GLFWwindow *window, double deltaTime);
-void renderCube();
-void renderScene(const Shader &shader, const Sandpile &pile);
+void stepSimulation(Sandpile &pile);
+void renderScene(const Shader &shader, const Sandpile &pile, const glm::mat4 &viewProjection);
 void renderGUI(Sandpile &pile);
 void updateLightSpace(Shader &a, Shader &b);
-void reset(Sandpile &pile, bool rand, bool resize);
-void exportFrequencyDistribution(const std::vector<int> &data, const Sandpile &pile);
+void reset(Sandpile &pile, Reset_Fill fill, bool resize);
+void recordSize(int size, const Avalanche &avalanche);
+void seekReplay(Sandpile &pile, int drop);
+void updateDropSource(Sandpile &pile);
+void renderAnalysis();
+void exportFrequencyDistribution(const Sandpile &pile);
 std::filesystem::path getExeDirectory();
 
-int main()
+int main(int argc, char **argv)
 {
+	//headless parameter sweep: sandpile --sweep <spec> [output directory]
+	if (argc >= 3 && std::string(argv[1]) == "--sweep")
+		return runSweep(argv[2], (argc >= 4) ? argv[3] : "sweep");
+	//headless frame export: sandpile --movie <width>x<height> <center|random> <drops> [output directory]
+	if (argc >= 5 && std::string(argv[1]) == "--movie")
+		return runMovie(argv[2], argv[3], argv[4], (argc >= 6) ? argv[5] : "movie");
+	//compare the batch and bit-plate engines with the sequential ones: sandpile --selftest [drops]
+	if (argc >= 2 && std::string(argv[1]) == "--selftest")
+		return runSelftest((argc >= 3) ? argv[2] : "20000");
+	//stream the running simulation to local clients: sandpile --telemetry <socket path>
+	if (argc >= 3 && std::string(argv[1]) == "--telemetry" && !telemetry.start(argv[2]))
+		return 1;
+
 	//initialize GLFW
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -102,6 +169,9 @@ int main()
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetKeyCallback(window, key_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
 	glfwSwapInterval(0);
 
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -179,6 +249,8 @@ int main()
 	//initialize image and sandpile object to cleared plate
 	Sandpile pile(20, 20);
 	pile.fillValue(0);
+	sizeStats.begin(pile.width * pile.height, pile.capacity);
+	replay.begin(pile, sizeStats);
 	plateImage = pile.plate;
 
 	//get relative filepaths to resources from exe
@@ -226,10 +298,10 @@ int main()
 		processInput(window, deltaTime);
 
 		//check max drop
-		if (pile.drops >= maxDrops && !pause) {
+		if (pile.drops >= maxDrops && !paused) {
 			pauseOnNextUpdate = true;
 			//data collection is offset by one (collects data on last drop on the beginning of next)
-			sizeData.push_back(pile.size);
+			recordSize(pile.size, pile.avalanche);
 			if (!display) {
 				display = true;
 				tempDisplay = true;
@@ -239,11 +311,11 @@ int main()
 		}
 
 		//update animation
-		if (!pause) {
+		if (!paused) {
 			if (currentFrame == animationFrames - 1) {
 				//animation is ending and pause is queued -> stay at end of animation under old animationFrames (tempAnimationFrames) and don't update
 				if (pauseOnNextUpdate || resizeOnNextUpdate) {
-					pause = true;
+					paused = true;
 					pauseOnNextUpdate = false;
 					animationFrames = tempAnimationFrames;
 					currentFrame = animationFrames - 1;
@@ -252,39 +324,63 @@ int main()
 						pile.width = tempPlateWidth;
 						pile.height = tempPlateHeight;
 						pile.resize();
+						sizeStats.begin(pile.width * pile.height, pile.capacity);
+						replay.begin(pile, sizeStats);
+						updateDropSource(pile);
 						updateLightSpace(simpleDepthShader, lightingShader);
 					}
 					//sync plate image with plate
+					pile.syncPlate();
 					plateImage = pile.plate;
+					plateChanged = true;
 				} else {
 					//normal end of update: change to next update
-					plateImage = pile.plate;
-					//if about to drop next get size data & drop type data (assuming there has already been at least 1 drop)
-					if (pile.affectedCells.size() == 0) {
-						if (pile.drops != 0)
-							sizeData.push_back(pile.size);
-						if (pile.center)
-							centerCount++;
-						else
-							randomCount++;
+					//the previous plate is only needed to animate from, so nothing is expanded or copied while nothing is shown
+					if (display) {
+						pile.syncPlate();
+						plateImage = pile.plate;
+					}
+					if (animationFrames == 1 && display) {
+						//nothing to animate: keep stepping for as long as the frame's time budget allows
+						auto budgetEnd = std::chrono::steady_clock::now() + std::chrono::microseconds((int) (stepBudget * 1000));
+						do {
+							stepSimulation(pile);
+						} while (!(pile.idle() && pile.drops >= maxDrops) && std::chrono::steady_clock::now() < budgetEnd);
+					} else {
+						stepSimulation(pile);
 					}
-					pile.update();
 					currentFrame = 0;
 				}
 			} else {
 				currentFrame++;
+				plateChanged = true;
 			}
 		}
 
-		if (display || pause) {
-			//render scene from light's point of view
-			simpleDepthShader.use();
+		//clients are only sent a message every telemetry.interval seconds
+		telemetry.publish(pile, sizeStats);
 
-			glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-			glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-			glClear(GL_DEPTH_BUFFER_BIT);
+		//skip drawing entirely if the last frame is still accurate
+		bool redraw = (display || paused) && (plateChanged || cameraChanged || windowChanged || guiFrames > 0);
 
-			renderScene(simpleDepthShader, pile);
+		if (redraw) {
+			//expand the plate if it is stored in reduced form
+			pile.syncPlate();
+
+			//the light is fixed, so the shadow map only has to be redone when the plate changes
+			if (plateChanged) {
+				//only the chunks whose cells changed are uploaded again
+				plateMesh.update(plateImage, pile.plate);
+
+				//render scene from light's point of view
+				simpleDepthShader.use();
+
+				glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+				glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+				glClear(GL_DEPTH_BUFFER_BIT);
+
+				renderScene(simpleDepthShader, pile, lightSpaceMatrix);
+			}
 
 			//reset viewport
 			glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -303,24 +399,36 @@ int main()
 			glActiveTexture(GL_TEXTURE1);
 			glBindTexture(GL_TEXTURE_2D, depthMap);
 
-			renderScene(lightingShader, pile);
+			renderScene(lightingShader, pile, projection * view);
 		}
 
 		//render GUI & event polling
-		if (display || pause)
+		if (redraw) {
 			renderGUI(pile);
+			plateChanged = false;
+			cameraChanged = false;
+			windowChanged = false;
+			if (guiFrames > 0)
+				guiFrames--;
+		}
 
-		glfwPollEvents();
+		//nothing will change until there is input, so block until then instead of spinning at 60 FPS.
+		//telemetry clients still get their messages (and new clients are let in) every telemetry.interval seconds
+		bool idle = paused && !plateChanged && !cameraChanged && !windowChanged && guiFrames == 0;
+		if (idle)
+			glfwWaitEventsTimeout((telemetry.running()) ? std::min(0.5, telemetry.interval) : 0.5);
+		else
+			glfwPollEvents();
 
 		//delay, to cap fps
 		double endTime = glfwGetTime();
 		double renderTime = endTime - startTime;
 		int delayTime = (msPerFrame - 1) - ((int) (renderTime * 1000));
 
-		if (display)
+		if (display && !idle)
 			std::this_thread::sleep_for(std::chrono::milliseconds(delayTime));
 
-		if (display || pause)
+		if (redraw)
 			glfwSwapBuffers(window);
 	}
 
@@ -328,9 +436,8 @@ int main()
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
-	glDeleteVertexArrays(1, &cubeVAO);
+	plateMesh.release();
 	glDeleteVertexArrays(1, &plateVAO);
-	glDeleteBuffers(1, &cubeVBO);
 	glDeleteBuffers(1, &plateVBO);
 
 	glfwTerminate();
@@ -342,11 +449,13 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 	glViewport(0, 0, width, height);
 	screenWidth = width;
 	screenHeight = height;
+	windowChanged = true;
 }
 
 void mouse_callback(GLFWwindow *window, double xpos, double ypos)
 {
 	if (!mouseFocused) {
+		guiFrames = guiSettleFrames;
 		return;
 	}
 	if (!mouseMoved) {
@@ -359,10 +468,12 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos)
 	lastX = xpos;
 	lastY = ypos;
 	camera.processMouseMovement(xoffset, yoffset);
+	cameraChanged = true;
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
+	guiFrames = guiSettleFrames;
 	if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
 		mouseFocused = !mouseFocused;
 		if (mouseFocused) {
@@ -373,12 +484,29 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 		}
 	}
 	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
-		pause = !pause;
+		paused = !paused;
 	}
 }
 
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+	guiFrames = guiSettleFrames;
+}
+
+void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
+{
+	guiFrames = guiSettleFrames;
+}
+
+//the window contents were lost, e.g. after being uncovered
+void window_refresh_callback(GLFWwindow *window)
+{
+	windowChanged = true;
+}
+
 void processInput(GLFWwindow *window, double deltaTime)
 {
+	glm::vec3 lastPos = camera.pos;
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
 	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
@@ -398,73 +526,40 @@ void processInput(GLFWwindow *window, double deltaTime)
 		camera.pos.y = 0;
 	if (camera.pos.y > 100)
 		camera.pos.y = 100;
+	if (camera.pos != lastPos)
+		cameraChanged = true;
 }
 
-void renderCube()
+//advance the pile by one update (or a batch of drops), collecting the size data of finished drops
+void stepSimulation(Sandpile &pile)
 {
-	if (cubeVAO == 0) {
-		float vertices[] = {
-			-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-			0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-			0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-			0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-			-0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-			-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-
-			-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-			0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-			0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-			0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-			-0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-			-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-
-			-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-			-0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-			-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-			-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-			-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-			-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-
-			0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-			0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-			0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-			0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-			0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-			0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-
-			-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-			0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-			0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-			0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-			-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-			-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-
-			-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
-			0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
-			0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-			0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-			-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-			-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f
-		};
-		glGenVertexArrays(1, &cubeVAO);
-		glGenBuffers(1, &cubeVBO);
-
-		glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-
-		glBindVertexArray(cubeVAO);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*) 0);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*) (3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	//if about to drop next get size data & drop type data (assuming there has already been at least 1 drop)
+	if (pile.idle()) {
+		replay.capture(pile, sizeStats, centerCount, randomCount);
+		if (pile.drops != 0)
+			recordSize(pile.size, pile.avalanche);
+		if (pile.center)
+			centerCount++;
+		else
+			randomCount++;
 	}
-	glBindVertexArray(cubeVAO);
-	glDrawArrays(GL_TRIANGLES, 0, 36);
-	glBindVertexArray(0);
+	if (!display && !pile.center && pile.idle()) {
+		//nothing is shown, so relax a whole batch of random drops in parallel
+		//the size of the last one is collected like any other drop, on the next update
+		int batch = std::min(dropBatchSize, maxDrops - pile.drops);
+		std::vector<int> sizes;
+		pile.dropBatch(batch, sizes);
+		for (int i = 0; i < batch - 1; i++)
+			recordSize(sizes[i], pile.avalanches[i]);
+		randomCount += batch - 1;
+	} else {
+		pile.update();
+	}
+	replay.record(pile.sites, !pile.center);
+	plateChanged = true;
 }
 
-void renderScene(const Shader &shader, const Sandpile &pile)
+void renderScene(const Shader &shader, const Sandpile &pile, const glm::mat4 &viewProjection)
 {
 	//translate plate
 	glm::mat4 model = glm::mat4(1.0f);
@@ -478,43 +573,29 @@ void renderScene(const Shader &shader, const Sandpile &pile)
 	shader.setVec3(glm::vec3(0.2f, 0.2f, 0.2f), "material.specular");
 	shader.setFloat(10.0f, "material.shininess");
 	shader.setBool(false, "cube");
+	shader.setBool(false, "instanced");
 
 	//draw plate
 	glBindVertexArray(plateVAO);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 
-	//set shininess (same for all cubes)
-	shader.setFloat(10.0f, "material.shininess");
+	//white, or cyan if highlighted
+	shader.setVec3(glm::vec3(1.0f, 1.0f, 1.0f), "material.ambient");
+	shader.setVec3(glm::vec3(1.0f, 1.0f, 1.0f), "material.diffuse");
+	shader.setVec3(glm::vec3(0.2f, 0.2f, 0.2f), "material.specular");
+	shader.setVec3(glm::vec3(0.0f, 1.0f, 1.0f), "highlightMaterial.ambient");
+	shader.setVec3(glm::vec3(0.0f, 1.0f, 1.0f), "highlightMaterial.diffuse");
+	shader.setVec3(glm::vec3(0.0f, 0.2f, 0.2f), "highlightMaterial.specular");
+	shader.setFloat(10.0f, "highlightMaterial.shininess");
+	shader.setBool(highlight, "highlight");
 	shader.setBool(true, "cube");
+	shader.setBool(true, "instanced");
 
-	//render cubes according to sandpile matrix
-	for (int i = 0; i < pile.width; i++) {
-		for (int j = 0; j < pile.height; j++) {
-			int target = pile.plate[i][j];
-			int prev = plateImage[i][j];
-			//frame 0 is just started, frame animationFrames - 1 is finished animation
-			double progress = (double) (currentFrame + 1) / (double) animationFrames;
-			//provide a buffer underneath plate if sand is being added
-			for (int k = std::min(0, prev - target); k < prev; k++) {
-				model = glm::mat4(1.0f);
-				//offset so that when the animation is paused on the last frame, the buffer does not show above the surface
-				model = glm::translate(model, glm::vec3(i, k + (target - prev) * progress - 0.005, j));
-				shader.setMat4(model, "model");
-				if (highlight && target >= 4) {
-					//cyan
-					shader.setVec3(glm::vec3(0.0f, 1.0f, 1.0f), "material.ambient");
-					shader.setVec3(glm::vec3(0.0f, 1.0f, 1.0f), "material.diffuse");
-					shader.setVec3(glm::vec3(0.0f, 0.2f, 0.2f), "material.specular");
-				} else {
-					//white
-					shader.setVec3(glm::vec3(1.0f, 1.0f, 1.0f), "material.ambient");
-					shader.setVec3(glm::vec3(1.0f, 1.0f, 1.0f), "material.diffuse");
-					shader.setVec3(glm::vec3(0.2f, 0.2f, 0.2f), "material.specular");
-				}
-				renderCube();
-			}
-		}
-	}
+	//frame 0 is just started, frame animationFrames - 1 is finished animation
+	shader.setFloat((float) (currentFrame + 1) / (float) animationFrames, "progress");
+
+	//render the cubes of the chunks that can be seen
+	plateMesh.draw(viewProjection);
 }
 
 void renderGUI(Sandpile &pile)
@@ -525,18 +606,26 @@ void renderGUI(Sandpile &pile)
 
 	ImGui::Begin("Controls", nullptr, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
 
-	if ((pause) ? ImGui::ImageButton((void*) (intptr_t) playTexture, ImVec2(32, 32)) : ImGui::ImageButton((void*) (intptr_t) pauseTexture, ImVec2(32, 32)))
-		pause = !pause;
+	if ((paused) ? ImGui::ImageButton((void*) (intptr_t) playTexture, ImVec2(32, 32)) : ImGui::ImageButton((void*) (intptr_t) pauseTexture, ImVec2(32, 32)))
+		paused = !paused;
 
 	ImGui::SameLine();
-	if (ImGui::Button("export data")) {
-		exportFrequencyDistribution(sizeData, pile);
+	if (exporter.busy()) {
+		//keep drawing the interface until the writer is done
+		ImGui::ProgressBar(exporter.progress(), ImVec2(100, 0));
+		guiFrames = guiSettleFrames;
+	} else if (ImGui::Button("export data")) {
+		exportFrequencyDistribution(pile);
+	}
+	if (!exporter.busy() && exporter.failed()) {
+		ImGui::SameLine();
+		ImGui::Text("export failed");
 	}
 
 	ImGui::SameLine();
 	ImGui::Checkbox("display", &tempDisplay);
 	if (tempDisplay != display) {
-		if (pause && !infinite) {
+		if (paused && !infinite) {
 			display = tempDisplay;
 			currentFrame = 0;
 			animationFrames = 1;
@@ -548,9 +637,23 @@ void renderGUI(Sandpile &pile)
 	ImGui::Checkbox("center", &pile.center);
 
 	ImGui::SameLine();
-	ImGui::Checkbox("highlight", &highlight);
+	ImGui::Checkbox("symmetric", &pile.symmetric);
 
 	ImGui::SameLine();
+	ImGui::Checkbox("highlight", &highlight);
+
+	if (!pile.center) {
+		bool sourceChanged = ImGui::Combo("source", &dropSource, "uniform\0gaussian\0line\0weight map\0");
+		if (dropSource == GAUSSIAN)
+			sourceChanged = ImGui::SliderFloat("spread", &sourceSpread, 0.02f, 0.5f, "%.2f") || sourceChanged;
+		else if (dropSource == LINE)
+			sourceChanged = ImGui::SliderFloat("angle", &sourceAngle, 0.0f, 180.0f, "%.0f") || sourceChanged;
+		else if (dropSource == WEIGHT_MAP)
+			sourceChanged = ImGui::Button("reload weights") || sourceChanged;
+		if (sourceChanged)
+			updateDropSource(pile);
+	}
+
 	ImGui::Checkbox("infinite", &infinite);
 
 	if (!infinite) {
@@ -560,34 +663,57 @@ void renderGUI(Sandpile &pile)
 	}
 
 	if (ImGui::Button("clear"))
-		reset(pile, false, false);
+		reset(pile, CLEAR, false);
 
 	ImGui::SameLine();
 	if (ImGui::Button("randomize"))
-		reset(pile, true, false);
+		reset(pile, RANDOMIZE, false);
+
+	ImGui::SameLine();
+	if (ImGui::Button("identity"))
+		reset(pile, IDENTITY, false);
+
+	ImGui::SameLine();
+	if (ImGui::Button("relaxed"))
+		reset(pile, RELAXED, false);
+
+	//jump back to any drop of this run, the drops after it are kept until the simulation continues from there
+	int position = replay.position;
+	if (ImGui::SliderInt("replay", &position, 0, replay.length()) && position != replay.position && !resizeOnNextUpdate)
+		seekReplay(pile, position);
 
 	ImGui::SliderInt("frames", &tempAnimationFrames, 1, 20);
 	if (ImGui::IsItemDeactivatedAfterEdit()) {
-		pause = true;
+		paused = true;
 		currentFrame = 0;
 		animationFrames = tempAnimationFrames;
 	}
 
+	if (animationFrames == 1)
+		ImGui::SliderFloat("budget (ms)", &stepBudget, 1.0f, 15.0f, "%.1f");
+
 	//clear before resizing
 	ImGui::InputInt("width", &tempPlateWidth);
 	if (ImGui::IsItemDeactivatedAfterEdit()) {
 		if (tempPlateWidth > 100)
 			tempPlateWidth = 100;
-		reset(pile, false, true);
+		reset(pile, CLEAR, true);
 	}
 
 	ImGui::InputInt("height", &tempPlateHeight);
 	if (ImGui::IsItemDeactivatedAfterEdit()) {
 		if (tempPlateHeight > 100)
 			tempPlateHeight = 100;
-		reset(pile, false, true);
+		reset(pile, CLEAR, true);
 	}
 
+	if (ImGui::CollapsingHeader("analysis"))
+		renderAnalysis();
+
+	//keep drawing while a widget is being used, e.g. for the text cursor
+	if (ImGui::IsAnyItemActive())
+		guiFrames = guiSettleFrames;
+
 	ImGui::End();
 
 	ImGui::Render();
@@ -598,7 +724,6 @@ void updateLightSpace(Shader &a, Shader &b)
 {
 	//light space calculations
 	glm::mat4 lightProjection, lightView;
-	glm::mat4 lightSpaceMatrix;
 	float camPos = std::max((float) tempPlateWidth / 2, (float) tempPlateHeight / 2);
 	float near_plate = -0.75 * camPos, far_plate = 1.5 * camPos;
 	lightProjection = glm::ortho((float) - 2.0 * camPos, (float) 2.0 * camPos, (float) - camPos, (float) camPos, near_plate, far_plate);
@@ -614,20 +739,26 @@ void updateLightSpace(Shader &a, Shader &b)
 	b.setMat4(lightSpaceMatrix, "lightSpaceMatrix");
 }
 
-void reset(Sandpile &pile, bool rand, bool resize)
+void reset(Sandpile &pile, Reset_Fill fill, bool resize)
 {
 	//unpause to play collpasing animation, and then pause again once the animation is complete
-	if (pause)
-		pause = false;
+	if (paused)
+		paused = false;
 	currentFrame = 0;
 	animationFrames = 10;
 	if (resize)
 		resizeOnNextUpdate = true;
 	else
 		pauseOnNextUpdate = true;
-	if (rand) {
+	if (fill == RANDOMIZE) {
 		pile.fillRand();
 		lastReset = "randomized";
+	} else if (fill == IDENTITY) {
+		pile.fillIdentity();
+		lastReset = "identity";
+	} else if (fill == RELAXED) {
+		pile.fillRelaxed();
+		lastReset = "relaxed";
 	} else {
 		pile.fillValue(0);
 		lastReset = "cleared";
@@ -635,45 +766,120 @@ void reset(Sandpile &pile, bool rand, bool resize)
 	centerCount = 0;
 	randomCount = 0;
 	pile.drops = 0;
-	sizeData.clear();
+	sizeStats.begin(pile.width * pile.height, pile.capacity);
+	replay.begin(pile, sizeStats);
+	plateChanged = true;
 }
 
-void exportFrequencyDistribution(const std::vector<int> &data, const Sandpile &pile)
+//collect the size and shape of a finished drop
+void recordSize(int size, const Avalanche &avalanche)
 {
-	std::map<int, int> dist;
-	for (int i : data) {
-		if (dist.find(i) == dist.end()) {
-			dist[i] = 1;
-		} else {
-			dist[i]++;
-		}
+	sizeStats.add(size, avalanche);
+}
+
+//rebuild the weights of the random drop sites for the current plate
+void updateDropSource(Sandpile &pile)
+{
+	//the new weights are built on the side and copied in, so only the columns that changed are rebuilt
+	//all zero, which means uniform
+	DropSource next;
+	next.resize(pile.width, pile.height);
+	double cx = (pile.width - 1) / 2.0, cy = (pile.height - 1) / 2.0;
+	double extent = std::max(pile.width, pile.height);
+	if (dropSource == GAUSSIAN) {
+		next.addGaussian(cx, cy, sourceSpread * extent);
+	} else if (dropSource == LINE) {
+		//through the center, long enough to cross the whole plate
+		double angle = glm::radians(sourceAngle);
+		double dx = std::cos(angle) * extent, dy = std::sin(angle) * extent;
+		next.addLine(cx - dx, cy - dy, cx + dx, cy + dy, 0.5);
+	} else if (dropSource == WEIGHT_MAP) {
+		if (!next.load("asp_weights.txt"))
+			dropSource = UNIFORM;
 	}
-	std::ofstream fs;
-	fs.open("asp_simInfo.txt", std::ios::out | std::ios::trunc);
-	if (!fs) {
-		std::cerr << "Could not open the output file." << std::endl;
+	pile.source.assign(next);
+}
+
+//show the plate as it was right after drop, paused
+void seekReplay(Sandpile &pile, int drop)
+{
+	if (!replay.seek(drop, pile, sizeStats, centerCount, randomCount))
 		return;
+	paused = true;
+	pauseOnNextUpdate = false;
+	currentFrame = animationFrames - 1;
+	plateImage = pile.plate;
+	plateChanged = true;
+}
+
+/*
+live power law fit and log-binned size distribution. the fit sums over every size in its range,
+so it is only redone a few times per second while drops come in.
+*/
+void renderAnalysis()
+{
+	static PowerLawFit fit = {};
+	//fits of area, duration and topples, from fit min up to the largest value
+	static PowerLawFit shapeFits[3] = {};
+	static double shapeMeans[3] = {};
+	static std::vector<float> density;
+	static float low, high;
+	static long long fitDrops = -1;
+	static double fitTime = 0.0;
+
+	//takes effect from the next drop, so it is best set right after a reset
+	ImGui::Checkbox("skip warm-up", &sizeStats.skipWarmup);
+	const Stationarity &warmup = sizeStats.warmup;
+	if (warmup.stationary())
+		ImGui::Text("stationary after %lld drops, height %.3f", warmup.since, warmup.meanHeight);
+	else
+		ImGui::Text("warming up: height %.3f, outflow %.2f per drop", warmup.meanHeight, warmup.outflow);
+	if (sizeStats.skipped > 0) {
+		ImGui::SameLine();
+		ImGui::TextDisabled("(%lld skipped)", sizeStats.skipped);
 	}
-	//store the simulation environment data in a separate file
-	fs << lastReset << "\n"
-	   << pile.width << "\n"
-	   << pile.height << "\n"
-	   << pile.drops << "\n"
-	   << centerCount << "\n"
-	   << randomCount << "\n";
-	fs.close();
-	fs.open("asp_freqDist.txt", std::ios::out | std::ios::trunc);
-	fs << "\tSize\tFreq.\n";
-	if (!fs) {
-		std::cerr << "Could not open the output file." << std::endl;
-		return;
+
+	ImGui::InputInt("fit min", &sizeStats.fitMin);
+	bool rangeChanged = ImGui::IsItemDeactivatedAfterEdit();
+	ImGui::InputInt("fit max", &sizeStats.fitMax);
+	rangeChanged = ImGui::IsItemDeactivatedAfterEdit() || rangeChanged;
+	sizeStats.fitMin = std::max(sizeStats.fitMin, 1);
+	sizeStats.fitMax = std::max(sizeStats.fitMax, 0);
+
+	if (rangeChanged || (sizeStats.drops != fitDrops && glfwGetTime() - fitTime > 0.5)) {
+		fit = sizeStats.fit();
+		density = sizeStats.logDensity(low, high);
+		const std::vector<long long> *histograms[] = {&sizeStats.areaFreq, &sizeStats.durationFreq, &sizeStats.topplesFreq};
+		for (int k = 0; k < 3; k++) {
+			shapeFits[k] = SizeStats::fitRange(*histograms[k], sizeStats.fitMin, 0);
+			shapeMeans[k] = SizeStats::mean(*histograms[k]);
+		}
+		fitDrops = sizeStats.drops;
+		fitTime = glfwGetTime();
 	}
-	int row = 0;
-	for (auto &pair : dist) {
-		row++;
-		fs << row << "\t" << pair.first << "\t" << pair.second << "\n";
+
+	ImGui::Text("drops: %lld, largest: %d", fitDrops, std::max(sizeStats.largest(), 0));
+	if (fit.valid)
+		ImGui::Text("alpha = %.3f +- %.3f (%d to %d, %lld drops)", fit.alpha, fit.error, fit.min, fit.max, fit.samples);
+	else
+		ImGui::TextDisabled("not enough data to fit");
+	const char *names[] = {"area", "duration", "topples"};
+	for (int k = 0; k < 3; k++) {
+		if (shapeFits[k].valid)
+			ImGui::Text("%s: mean %.1f, alpha = %.3f +- %.3f", names[k], shapeMeans[k], shapeFits[k].alpha, shapeFits[k].error);
+		else
+			ImGui::Text("%s: mean %.1f", names[k], shapeMeans[k]);
 	}
-	fs.close();
+	ImGui::Text("mean gyration: %.2f", sizeStats.meanGyration());
+	if (!density.empty())
+		ImGui::PlotLines("log p(s)", density.data(), (int) density.size(), 0, "log size ->", low, high, ImVec2(0, 80));
+}
+
+//copy the distribution and write it in the background, so long runs don't freeze the window
+void exportFrequencyDistribution(const Sandpile &pile)
+{
+	SizeStats snapshot = sizeStats;
+	exporter.start(".", {lastReset, pile.width, pile.height, pile.drops, centerCount, randomCount}, std::move(snapshot));
 }
 
 std::filesystem::path getExeDirectory()
@@ -0,0 +1,183 @@
+#include "movie.hpp"
+#include "stb_image_write.h"
+
+FrameEncoder::FrameEncoder(const std::filesystem::path &dir, int scale, int threads)
+{
+	this->dir = dir;
+	this->scale = std::max(1, scale);
+	next = 0;
+	closing = false;
+	failed = 0;
+	std::filesystem::create_directories(dir);
+	if (threads <= 0)
+		threads = std::max(1, (int) std::thread::hardware_concurrency() - 1);
+	//enough frames in flight to ride out a slow disk without holding the whole run in memory
+	maxQueued = threads * 8;
+	for (int t = 0; t < threads; t++)
+		workers.emplace_back(&FrameEncoder::work, this);
+}
+
+FrameEncoder::~FrameEncoder()
+{
+	finish();
+}
+
+/*
+queue a snapshot of the plate. this only copies the cells, so it returns right away
+unless the encoders have fallen maxQueued frames behind.
+*/
+void FrameEncoder::submit(const Sandpile &pile)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	space.wait(lock, [this]() { return (int) queue.size() < maxQueued; });
+	Frame frame;
+	frame.index = next++;
+	frame.width = pile.width;
+	frame.height = pile.height;
+	if (!spare.empty()) {
+		frame.cells = std::move(spare.back());
+		spare.pop_back();
+	}
+	lock.unlock();
+
+	frame.cells.resize((std::size_t) pile.width * pile.height);
+	for (int y = 0; y < pile.height; y++)
+		for (int x = 0; x < pile.width; x++)
+			frame.cells[(std::size_t) y * pile.width + x] = (unsigned char) std::min(pile.plate[x][y], 255);
+
+	lock.lock();
+	queue.push_back(std::move(frame));
+	lock.unlock();
+	ready.notify_one();
+}
+
+//wait for every queued frame to be written, returns false if any of them failed
+bool FrameEncoder::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closing = true;
+	}
+	ready.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+	workers.clear();
+	return failed == 0;
+}
+
+int FrameEncoder::frames() const
+{
+	return next;
+}
+
+void FrameEncoder::work()
+{
+	std::vector<unsigned char> pixels;
+	char name[32];
+	while (true) {
+		std::unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [this]() { return closing || !queue.empty(); });
+		if (queue.empty())
+			return;
+		Frame frame = std::move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+		space.notify_one();
+
+		rasterize(frame, pixels);
+		std::snprintf(name, sizeof(name), "frame_%06d.png", frame.index);
+		int w = frame.width * scale, h = frame.height * scale;
+		if (!stbi_write_png((dir / name).string().c_str(), w, h, 3, pixels.data(), w * 3)) {
+			if (failed++ == 0)
+				std::cerr << "Could not write " << (dir / name).string() << std::endl;
+		}
+
+		//hand the cell buffer back so submit doesn't have to allocate
+		lock.lock();
+		spare.push_back(std::move(frame.cells));
+	}
+}
+
+/*
+draw the height map from above: every cell is a scale x scale square, brighter for more grains
+and cyan while it is collapsing, like the highlight in the window. cells get a dark outline
+once they are big enough for it to be visible.
+*/
+void FrameEncoder::rasterize(const Frame &frame, std::vector<unsigned char> &pixels) const
+{
+	static const unsigned char colors[5][3] = {
+		{40, 40, 40},
+		{110, 110, 110},
+		{180, 180, 180},
+		{245, 245, 245},
+		{0, 255, 255}
+	};
+	int w = frame.width * scale;
+	bool outline = scale >= 4;
+	pixels.resize((std::size_t) w * frame.height * scale * 3);
+	for (int y = 0; y < frame.height; y++) {
+		for (int py = 0; py < scale; py++) {
+			unsigned char *row = &pixels[((std::size_t) (y * scale + py) * w) * 3];
+			for (int x = 0; x < frame.width; x++) {
+				const unsigned char *color = colors[std::min((int) frame.cells[(std::size_t) y * frame.width + x], 4)];
+				for (int px = 0; px < scale; px++) {
+					bool edge = outline && (px == 0 || py == 0);
+					row[0] = edge ? color[0] / 2 : color[0];
+					row[1] = edge ? color[1] / 2 : color[1];
+					row[2] = edge ? color[2] / 2 : color[2];
+					row += 3;
+				}
+			}
+		}
+	}
+}
+
+/*
+headless movie export: simulate from a cleared plate and write one frame per update, so every
+layer of every avalanche is in the sequence. no window or OpenGL context is needed.
+	size: e.g. 101x101
+	mode: center or random
+	drops: number of grains to drop
+*/
+int runMovie(const std::string &size, const std::string &mode, const std::string &drops, const std::filesystem::path &outDir)
+{
+	int width, height, maxDrops;
+	try {
+		std::size_t x = size.find('x');
+		if (x == std::string::npos)
+			throw std::runtime_error("bad size " + size);
+		width = std::stoi(size.substr(0, x));
+		height = std::stoi(size.substr(x + 1));
+		if (width < 1 || height < 1 || width > 1000 || height > 1000)
+			throw std::runtime_error("bad size " + size);
+		if (mode != "center" && mode != "random")
+			throw std::runtime_error("bad mode " + mode);
+		maxDrops = std::stoi(drops);
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	Sandpile pile(width, height);
+	pile.center = (mode == "center");
+	pile.symmetric = pile.center;
+	pile.fillValue(0);
+
+	//the encoder creates outDir, which fails e.g. if a file is in the way
+	try {
+		//about 800 pixels across, whatever the plate size
+		FrameEncoder encoder(outDir, 800 / std::max(width, height));
+		encoder.submit(pile);
+		while (!(pile.idle() && pile.drops >= maxDrops)) {
+			pile.update();
+			pile.syncPlate();
+			encoder.submit(pile);
+		}
+		bool ok = encoder.finish();
+		std::cout << encoder.frames() << " frames written to " << outDir.string() << std::endl;
+		return ok ? 0 : 1;
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,195 @@
+#include "platemesh.hpp"
+
+PlateMesh::PlateMesh()
+	: width(0), height(0), cubeVBO(0)
+{
+}
+
+/*
+bring the instance buffers in line with an animation from prev to target.
+a cell draws max(prev, target) cubes: prev cubes moving by (target - prev), with a buffer underneath
+the plate if sand is being added. the move itself is done in the shaders from the progress uniform,
+so during an animation nothing has to be uploaded.
+*/
+void PlateMesh::update(const std::vector<std::vector<int>> &prev, const std::vector<std::vector<int>> &target)
+{
+	if (cubeVBO == 0)
+		createCube();
+
+	int newWidth = (int) target.size();
+	int newHeight = (newWidth > 0) ? (int) target[0].size() : 0;
+	if (newWidth != width || newHeight != height) {
+		release();
+		createCube();
+		width = newWidth;
+		height = newHeight;
+		for (int x = 0; x < width; x += chunkSize) {
+			for (int z = 0; z < height; z += chunkSize) {
+				Chunk chunk = {x, z, std::min(x + chunkSize, width), std::min(z + chunkSize, height), 0.0f, 0.0f, 0, 0, 0};
+				glGenVertexArrays(1, &chunk.VAO);
+				glGenBuffers(1, &chunk.VBO);
+				glBindVertexArray(chunk.VAO);
+				glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*) 0);
+				glEnableVertexAttribArray(0);
+				glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*) (3 * sizeof(float)));
+				glEnableVertexAttribArray(1);
+				//per cube: cell position and level, change in height, and the target height of the cell
+				glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO);
+				glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*) 0);
+				glEnableVertexAttribArray(2);
+				glVertexAttribDivisor(2, 1);
+				glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*) (4 * sizeof(float)));
+				glEnableVertexAttribArray(3);
+				glVertexAttribDivisor(3, 1);
+				glBindVertexArray(0);
+				upload(chunk, prev, target);
+				chunks.push_back(chunk);
+			}
+		}
+		lastPrev = prev;
+		lastTarget = target;
+		return;
+	}
+
+	for (Chunk &chunk : chunks) {
+		bool changed = false;
+		for (int i = chunk.x0; i < chunk.x1 && !changed; i++)
+			for (int j = chunk.z0; j < chunk.z1 && !changed; j++)
+				changed = prev[i][j] != lastPrev[i][j] || target[i][j] != lastTarget[i][j];
+		if (!changed)
+			continue;
+		upload(chunk, prev, target);
+		for (int i = chunk.x0; i < chunk.x1; i++) {
+			std::copy(prev[i].begin() + chunk.z0, prev[i].begin() + chunk.z1, lastPrev[i].begin() + chunk.z0);
+			std::copy(target[i].begin() + chunk.z0, target[i].begin() + chunk.z1, lastTarget[i].begin() + chunk.z0);
+		}
+	}
+}
+
+//draw the chunks that intersect the view volume of viewProjection, returning how many were drawn
+int PlateMesh::draw(const glm::mat4 &viewProjection)
+{
+	//planes of the view volume, from the rows of the matrix (glm is column major)
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; r++)
+		rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+	glm::vec4 planes[6] = {
+		rows[3] + rows[0], rows[3] - rows[0],
+		rows[3] + rows[1], rows[3] - rows[1],
+		rows[3] + rows[2], rows[3] - rows[2]
+	};
+
+	int drawn = 0;
+	for (const Chunk &chunk : chunks) {
+		if (chunk.instances == 0 || !isVisible(chunk, planes))
+			continue;
+		glBindVertexArray(chunk.VAO);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 36, chunk.instances);
+		drawn++;
+	}
+	glBindVertexArray(0);
+	return drawn;
+}
+
+void PlateMesh::release()
+{
+	for (Chunk &chunk : chunks) {
+		glDeleteVertexArrays(1, &chunk.VAO);
+		glDeleteBuffers(1, &chunk.VBO);
+	}
+	chunks.clear();
+	if (cubeVBO != 0)
+		glDeleteBuffers(1, &cubeVBO);
+	cubeVBO = 0;
+	width = 0;
+	height = 0;
+}
+
+void PlateMesh::createCube()
+{
+	float vertices[] = {
+		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+		0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+		0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+		0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+		-0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+		-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
+
+		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+		0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+		0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+		0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+		-0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
+
+		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
+		-0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
+		-0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
+		-0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
+
+		0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
+		0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
+		0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
+		0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
+		0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
+		0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
+
+		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
+		0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
+		0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
+		0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
+		-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
+		-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
+
+		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
+		0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
+		0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
+		0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
+		-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
+		-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f
+	};
+	glGenBuffers(1, &cubeVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//rebuild the instances of one chunk and its vertical extent over the whole animation
+void PlateMesh::upload(Chunk &chunk, const std::vector<std::vector<int>> &prev, const std::vector<std::vector<int>> &target)
+{
+	instanceData.clear();
+	chunk.minY = 0.0f;
+	chunk.maxY = 0.0f;
+	for (int i = chunk.x0; i < chunk.x1; i++) {
+		for (int j = chunk.z0; j < chunk.z1; j++) {
+			int delta = target[i][j] - prev[i][j];
+			for (int k = std::min(0, -delta); k < prev[i][j]; k++) {
+				instanceData.insert(instanceData.end(), {(float) i, (float) k, (float) j, (float) delta, (float) target[i][j]});
+				chunk.minY = std::min(chunk.minY, k + std::min(0, delta) - 0.505f);
+				chunk.maxY = std::max(chunk.maxY, k + std::max(0, delta) + 0.5f);
+			}
+		}
+	}
+	chunk.instances = (int) instanceData.size() / 5;
+	glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO);
+	glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(float), instanceData.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//a box is outside if it is entirely behind one of the planes
+bool PlateMesh::isVisible(const Chunk &chunk, const glm::vec4 planes[6])
+{
+	glm::vec3 low(chunk.x0 - 0.5f, chunk.minY, chunk.z0 - 0.5f);
+	glm::vec3 high(chunk.x1 - 0.5f, chunk.maxY, chunk.z1 - 0.5f);
+	for (int p = 0; p < 6; p++) {
+		const glm::vec4 &plane = planes[p];
+		//corner furthest along the plane normal
+		glm::vec3 corner((plane.x > 0) ? high.x : low.x, (plane.y > 0) ? high.y : low.y, (plane.z > 0) ? high.z : low.z);
+		if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,251 @@
+#include "replay.hpp"
+
+ReplayLog::ReplayLog()
+	: keyframeInterval(10000), position(0), drops(0), lastX(0), lastY(0)
+{
+}
+
+//free the histograms and bin edges of stats, leaving the totals
+static void stripHistograms(SizeStats &stats)
+{
+	std::vector<long long>().swap(stats.freq);
+	std::vector<long long>().swap(stats.bins);
+	std::vector<long long>().swap(stats.areaFreq);
+	std::vector<long long>().swap(stats.durationFreq);
+	std::vector<long long>().swap(stats.topplesFreq);
+	std::vector<int>().swap(stats.edges);
+}
+
+//the nonzero differences between two histograms, where now is at least as long as before
+static void histogramDelta(const std::vector<long long> &now, const std::vector<long long> &before, std::vector<std::pair<int, long long>> &delta)
+{
+	for (std::size_t i = 0; i < now.size(); i++) {
+		long long change = now[i] - ((i < before.size()) ? before[i] : 0);
+		if (change != 0)
+			delta.push_back({(int) i, change});
+	}
+}
+
+//add a delta to a histogram. the last entry of a histogram is never 0, so its length is the last index changed + 1
+static void applyDelta(const std::vector<std::pair<int, long long>> &delta, std::vector<long long> &histogram)
+{
+	for (const std::pair<int, long long> &change : delta) {
+		if (change.first >= (int) histogram.size())
+			histogram.resize(change.first + 1, 0);
+		histogram[change.first] += change.second;
+	}
+}
+
+//start a new run from the current plate, stats should be empty as well
+void ReplayLog::begin(Sandpile &pile, const SizeStats &stats)
+{
+	keyframes.clear();
+	stream.clear();
+	drops = 0;
+	position = 0;
+	lastX = 0;
+	lastY = 0;
+	recorded = SizeStats();
+	stripHistograms(recorded);
+	capture(pile, stats, 0, 0);
+}
+
+/*
+called between drops, before the size of the last drop is added to stats.
+stores a keyframe once keyframeInterval drops have passed since the last one.
+*/
+void ReplayLog::capture(Sandpile &pile, const SizeStats &stats, int centerCount, int randomCount)
+{
+	//after seeking back, the keyframes ahead are still valid until the run goes somewhere else
+	if (position < drops)
+		return;
+	if (!keyframes.empty() && position - keyframes.back().drop < keyframeInterval)
+		return;
+	pile.syncPlate();
+	Keyframe key;
+	key.drop = position;
+	key.offset = stream.size();
+	key.x = lastX;
+	key.y = lastY;
+	key.width = pile.width;
+	key.height = pile.height;
+	key.cells.assign(((std::size_t) pile.width * pile.height + 3) / 4, 0);
+	for (int i = 0; i < pile.width; i++) {
+		for (int j = 0; j < pile.height; j++) {
+			//cells that just collapsed still hold n >= 4 until the next update
+			std::size_t c = (std::size_t) i * pile.height + j;
+			key.cells[c / 4] |= (pile.plate[i][j] % 4) << (c % 4 * 2);
+		}
+	}
+	key.size = pile.size;
+	key.avalanche = pile.avalanche;
+	histogramDelta(stats.freq, recorded.freq, key.freq);
+	histogramDelta(stats.bins, recorded.bins, key.bins);
+	histogramDelta(stats.areaFreq, recorded.areaFreq, key.areaFreq);
+	histogramDelta(stats.durationFreq, recorded.durationFreq, key.durationFreq);
+	histogramDelta(stats.topplesFreq, recorded.topplesFreq, key.topplesFreq);
+	//edges are only ever appended
+	key.edges.assign(stats.edges.begin() + recorded.edges.size(), stats.edges.end());
+	recorded = stats;
+	key.stats = stats;
+	stripHistograms(key.stats);
+	key.centerCount = centerCount;
+	key.randomCount = randomCount;
+	keyframes.push_back(std::move(key));
+}
+
+//append the drops at sites, dropping the part of the run that came after position if it was seeked back
+void ReplayLog::record(const std::vector<std::pair<int, int>> &sites, bool random)
+{
+	if (sites.empty())
+		return;
+	if (position < drops)
+		truncate(position);
+	for (const std::pair<int, int> &site : sites) {
+		//the lowest bit of the x change tells random drops from centered ones
+		putVarint(stream, zigzag(site.first - lastX) << 1 | random);
+		putSigned(stream, site.second - lastY);
+		lastX = site.first;
+		lastY = site.second;
+	}
+	drops += (int) sites.size();
+	position = drops;
+}
+
+int ReplayLog::length() const
+{
+	return drops;
+}
+
+//memory used by the drop sites, the keyframes and the statistics the next keyframe is compared with
+std::size_t ReplayLog::bytes() const
+{
+	std::size_t total = stream.size();
+	for (const Keyframe &key : keyframes) {
+		std::size_t changes = key.freq.size() + key.bins.size() + key.areaFreq.size() + key.durationFreq.size() + key.topplesFreq.size();
+		total += sizeof(Keyframe) + key.cells.size() + changes * sizeof(std::pair<int, long long>) + key.edges.size() * sizeof(int);
+	}
+	total += (recorded.freq.size() + recorded.bins.size() + recorded.areaFreq.size() + recorded.durationFreq.size()
+	          + recorded.topplesFreq.size()) * sizeof(long long) + recorded.edges.size() * sizeof(int);
+	return total;
+}
+
+/*
+restore the pile, statistics and drop counts to how they were right after drop, like it was just reached.
+the drops after the keyframe are relaxed all at once with the batch engine, without animation.
+*/
+bool ReplayLog::seek(int drop, Sandpile &pile, SizeStats &stats, int &centerCount, int &randomCount)
+{
+	if (keyframes.empty())
+		return false;
+	drop = std::max(0, std::min(drop, drops));
+	auto key = keyframeBefore(drop);
+	if (key->width != pile.width || key->height != pile.height)
+		return false;
+
+	std::vector<std::vector<int>> cells(key->width, std::vector<int>(key->height));
+	for (int i = 0; i < key->width; i++) {
+		for (int j = 0; j < key->height; j++) {
+			std::size_t c = (std::size_t) i * key->height + j;
+			cells[i][j] = (key->cells[c / 4] >> (c % 4 * 2)) & 3;
+		}
+	}
+	pile.setPlate(cells);
+	pile.drops = key->drop;
+	pile.size = key->size;
+	pile.avalanche = key->avalanche;
+	//the fit range and skipping the warm-up are settings, not part of the run
+	int fitMin = stats.fitMin, fitMax = stats.fitMax;
+	bool skipWarmup = stats.skipWarmup;
+	restore(key, stats);
+	stats.fitMin = fitMin;
+	stats.fitMax = fitMax;
+	stats.skipWarmup = skipWarmup;
+	centerCount = key->centerCount;
+	randomCount = key->randomCount;
+
+	std::size_t offset = key->offset;
+	int x = key->x, y = key->y;
+	std::vector<std::pair<int, int>> sites;
+	std::vector<bool> random;
+	std::vector<int> sizes;
+	for (int done = key->drop; done < drop; done += (int) sites.size()) {
+		int count = std::min(1 << 12, drop - done);
+		sites.resize(count);
+		random.resize(count);
+		for (int k = 0; k < count; k++) {
+			bool r;
+			offset = decode(offset, x, y, r);
+			sites[k] = {x, y};
+			random[k] = r;
+		}
+		//the size of every drop is added to the statistics when the next one starts, like in the running simulation
+		int before = pile.size;
+		Avalanche shape = pile.avalanche;
+		bool first = pile.drops == 0;
+		pile.dropSites(sites, sizes);
+		for (int k = 0; k < count; k++) {
+			if (!first || k > 0)
+				stats.add((k == 0) ? before : sizes[k - 1], (k == 0) ? shape : pile.avalanches[k - 1]);
+			if (random[k])
+				randomCount++;
+			else
+				centerCount++;
+		}
+	}
+	position = drop;
+	return true;
+}
+
+//forget every drop after drop, and the keyframes that came after it
+void ReplayLog::truncate(int drop)
+{
+	auto key = keyframeBefore(drop);
+	std::size_t offset = key->offset;
+	int x = key->x, y = key->y;
+	for (int i = key->drop; i < drop; i++) {
+		bool random;
+		offset = decode(offset, x, y, random);
+	}
+	keyframes.erase(key + 1, keyframes.cend());
+	restore(keyframes.cend() - 1, recorded);
+	stream.resize(offset);
+	lastX = x;
+	lastY = y;
+	drops = drop;
+}
+
+//the statistics at key, adding up the histogram changes of every keyframe up to it
+void ReplayLog::restore(std::vector<Keyframe>::const_iterator key, SizeStats &stats) const
+{
+	stats = key->stats;
+	for (auto k = keyframes.cbegin(); k != key + 1; k++) {
+		applyDelta(k->freq, stats.freq);
+		applyDelta(k->bins, stats.bins);
+		applyDelta(k->areaFreq, stats.areaFreq);
+		applyDelta(k->durationFreq, stats.durationFreq);
+		applyDelta(k->topplesFreq, stats.topplesFreq);
+		stats.edges.insert(stats.edges.end(), k->edges.begin(), k->edges.end());
+	}
+	//bins without drops at the end aren't in any delta
+	stats.bins.resize(stats.edges.size() - 1, 0);
+}
+
+//read the drop at offset, moving x and y to its site, and return the offset of the next drop
+std::size_t ReplayLog::decode(std::size_t offset, int &x, int &y, bool &random) const
+{
+	uint64_t first = getVarint(stream.data(), stream.size(), offset);
+	random = first & 1;
+	x += (int) unzigzag(first >> 1);
+	y += (int) getSigned(stream.data(), stream.size(), offset);
+	return offset;
+}
+
+//last keyframe at or before drop
+std::vector<ReplayLog::Keyframe>::const_iterator ReplayLog::keyframeBefore(int drop) const
+{
+	auto key = std::upper_bound(keyframes.begin(), keyframes.end(), drop, [](int d, const Keyframe &k) {
+		return d < k.drop;
+	});
+	return key - 1;
+}
@@ -1,110 +1,805 @@
 
 #include "sandpile.hpp"
 
-Sandpile::Sandpile(int width, int height)
-	: width(width), height(height), drops(0), capacity(0), size(0), center(true), currentDepth(-1)
+Sandpile::Sandpile(int width, int height, unsigned int seed)
+	: width(width), height(height), drops(0), capacity(0), size(0), center(true), symmetric(false), threads(0),
+	  currentDepth(-1), rng(seed), visitGeneration(0), reduced(false), plateStale(false), foldFailed(false), batchGeneration(0)
 {
 	plate = std::vector<std::vector<int>>(width, std::vector<int>(height, 0));
-	std::srand(time(0));
+	resetFrontier();
 }
 
 /*
 advance simulation by one layer.
-use two queues, one for the cells affected by a collapse and one to keep track of the depths of each affected cell.
-each update, iterate over all of the affected cells of depth = currentDepth and process them.
-use another queue to store the positions of the collapsing cells;
-we have to clean those up in the next update for them to be shown on the current update.
+the cells reached by the current layer are kept in a frontier bitset, together with the number of grains
+each of them receives, so a cell hit by several toppling neighbours is only processed once.
+layers too small to be split over the cores (nearly all of them) also list their cells, and are walked through the lists.
+each update, first settle the cells that collapsed in the previous update (they keep n >= 4 for one update
+so they can be highlighted), then add the incoming grains to the frontier and topple,
+and finally gather the grains sent by the toppled cells into the next frontier.
+the shape of the avalanche (area, duration, topples, gyration) is summed up while toppling.
+while the reduced (symmetric) mode is active the layers run over the wedge instead,
+and every wedge cell stands in for its whole orbit under the symmetries of the plate.
 */
 void Sandpile::update()
 {
-	if (affectedCells.size() == 0) {
+	settleCollapsing();
+	sites.clear();
+
+	if (idle()) {
+		//switch storage between drops, when no avalanche is in flight
+		if (symmetric && center && !reduced && !foldFailed)
+			foldPlate();
+		else if (reduced && !(symmetric && center))
+			unfoldPlate();
 		//drop new
 		drops++;
 		size = 0;
+		avalanche = Avalanche();
+		visitGeneration++;
 		currentDepth = 0;
-		if (center)
-			dropOne(width / 2, height / 2, 0, false);
-		else
-			dropOne(std::rand() % width, std::rand() % height, 0, false);
+		std::pair<int, int> site = nextDropSite();
+		sites.push_back(site);
+		int c = (reduced) ? wedgeIndex(site.first, site.second) : site.first * layerStride + site.second;
+		incoming[c] = 1;
+		frontier[c / 64] |= 1ULL << (c % 64);
+		frontierList.assign(1, {c / layerStride, c % layerStride});
+		frontierListed = true;
+		frontierCells = 1;
+		frontierFirst = frontierLast = c / layerStride;
+		frontierFirstWord = frontierLastWord = c % layerStride / 64;
+		capacity += (reduced) ? wedgeWeight[c] : 1;
 	}
 
-	while (collapsingCells.size() > 0) {
-		std::pair<int, int> pos = collapsingCells.front();
-		plate[pos.first][pos.second] = plate[pos.first][pos.second] % 4;
-		collapsingCells.pop();
+	if (reduced)
+		plateStale = true;
+	toppleFrontier();
+	if (reduced)
+		gatherWedge();
+	else
+		gatherPlate();
+	currentDepth++;
+}
+
+bool Sandpile::idle() const
+{
+	return frontierCells == 0;
+}
+
+/*
+run a sweep over the rows first..last of the layer storage, split into one block per core when there is enough work.
+blocks cover whole rows, and rows are padded to whole words, so no two blocks share a word.
+a layer only has that much work on plates well past the 100x100 the window allows, so in practice this is for headless runs.
+the sweep is a template parameter so the serial case, which is almost every layer, is a direct call summing on the stack.
+*/
+template <typename Sweep>
+Sandpile::LayerSums Sandpile::sweepRows(int first, int last, int work, const Sweep &sweep)
+{
+	LayerSums total;
+	int rows = last - first + 1;
+	int blocks = (serialWork(work)) ? 1 : std::min(rows, workerCount());
+	if (blocks <= 1) {
+		sweep(first, last + 1, total);
+		return total;
+	}
+	std::vector<LayerSums> sums(blocks);
+	WorkerPool::shared().run(blocks, [first, rows, blocks, &sweep, &sums](int b) {
+		sweep(first + rows * b / blocks, first + rows * (b + 1) / blocks, sums[b]);
+	});
+	for (LayerSums &part : sums) {
+		total.size += part.size;
+		total.capacity += part.capacity;
+		total.cells += part.cells;
+		total.topples += part.topples;
+		total.area += part.area;
+		total.sumX += part.sumX;
+		total.sumY += part.sumY;
+		total.sumSquares += part.sumSquares;
+		total.first = std::min(total.first, part.first);
+		total.last = std::max(total.last, part.last);
+		total.firstWord = std::min(total.firstWord, part.firstWord);
+		total.lastWord = std::max(total.lastWord, part.lastWord);
 	}
+	return total;
+}
 
-	while (affectedCells.size() > 0 && depths.front() == currentDepth) {
+//bring the cells that collapsed in the last update back to n < 4
+void Sandpile::settleCollapsing()
+{
+	if (collapsingCells == 0)
+		return;
+	if (collapsingListed) {
+		for (std::pair<int, int> cell : collapsingList) {
+			int i = cell.first, j = cell.second, c = i * layerStride + j;
+			int *row = (reduced) ? wedge.data() : plate[i].data();
+			row[j] %= 4;
+			toppled[c] = 0;
+			collapsing[c / 64] = 0;
+		}
+		collapsingList.clear();
+		collapsingCells = 0;
+		return;
+	}
+	int rowWords = layerStride / 64, firstWord = collapsingFirstWord, lastWord = collapsingLastWord;
+	sweepRows(collapsingFirst, collapsingLast, collapsingCells, [this, rowWords, firstWord, lastWord](int first, int last, LayerSums &) {
+		for (int i = first; i < last; i++) {
+			int *row = (reduced) ? wedge.data() : plate[i].data();
+			for (int k = firstWord; k <= lastWord; k++) {
+				uint64_t bits = collapsing[i * rowWords + k];
+				collapsing[i * rowWords + k] = 0;
+				while (bits != 0) {
+					int j = k * 64 + lowestBit(bits);
+					bits &= bits - 1;
+					row[j] %= 4;
+					toppled[i * layerStride + j] = 0;
+				}
+			}
+		}
+	});
+	collapsingCells = 0;
+}
 
-		std::pair<int, int> dim = affectedCells.front();
-		int depth = depths.front();
+/*
+add the incoming grains of cell (i, j) of the layer storage and topple it if it reaches n >= 4.
+the cell was below 4 before this layer, so it topples once for every 4 grains it holds.
+*/
+inline bool Sandpile::toppleCell(int i, int j, LayerSums &sums)
+{
+	int c = i * layerStride + j;
+	int &n = (reduced) ? wedge[j] : plate[i][j];
+	n += incoming[c];
+	incoming[c] = 0;
+	if (n < 4)
+		return false;
+	int weight = (reduced) ? wedgeWeight[j] : 1;
+	toppled[c] = n / 4;
+	//assume that all the grains fall off, and make it back up when gathering
+	sums.size += 4 * toppled[c] * weight;
+	sums.capacity -= 4 * toppled[c] * weight;
+	sums.cells++;
+	sums.topples += (long long) toppled[c] * weight;
+	if (visited[c] != visitGeneration) {
+		visited[c] = visitGeneration;
+		sums.area += weight;
+		if (reduced) {
+			sums.sumX += orbitX[j];
+			sums.sumY += orbitY[j];
+			sums.sumSquares += orbitSquares[j];
+		} else {
+			sums.sumX += i;
+			sums.sumY += j;
+			sums.sumSquares += (long long) i * i + (long long) j * j;
+		}
+	}
+	sums.first = std::min(sums.first, i);
+	sums.last = std::max(sums.last, i);
+	sums.firstWord = std::min(sums.firstWord, j / 64);
+	sums.lastWord = std::max(sums.lastWord, j / 64);
+	return true;
+}
+
+/*
+add the incoming grains of the frontier and topple every cell that reaches n >= 4.
+a frontier built by the serial gather is also listed, then only its cells are visited instead of scanning the rows.
+*/
+void Sandpile::toppleFrontier()
+{
+	LayerSums total;
+	if (frontierListed && serialWork(frontierCells)) {
+		collapsingList.clear();
+		for (std::pair<int, int> cell : frontierList) {
+			int i = cell.first, j = cell.second, c = i * layerStride + j;
+			frontier[c / 64] = 0;
+			if (toppleCell(i, j, total)) {
+				collapsing[c / 64] |= 1ULL << (c % 64);
+				collapsingList.push_back(cell);
+			}
+		}
+		collapsingListed = true;
+	} else {
+		int rowWords = layerStride / 64, firstWord = frontierFirstWord, lastWord = frontierLastWord;
+		total = sweepRows(frontierFirst, frontierLast, frontierCells, [this, rowWords, firstWord, lastWord](int first, int last, LayerSums &sums) {
+			for (int i = first; i < last; i++) {
+				for (int k = firstWord; k <= lastWord; k++) {
+					uint64_t bits = frontier[i * rowWords + k];
+					frontier[i * rowWords + k] = 0;
+					while (bits != 0) {
+						int j = k * 64 + lowestBit(bits);
+						bits &= bits - 1;
+						if (toppleCell(i, j, sums))
+							collapsing[i * rowWords + k] |= 1ULL << (j % 64);
+					}
+				}
+			}
+		});
+		collapsingListed = false;
+	}
+	frontierList.clear();
+	size += total.size;
+	capacity += total.capacity;
+	avalanche.topples += total.topples;
+	avalanche.area += total.area;
+	avalanche.sumX += total.sumX;
+	avalanche.sumY += total.sumY;
+	avalanche.sumSquares += total.sumSquares;
+	if (total.cells > 0)
+		avalanche.duration = currentDepth + 1;
+	collapsingCells = total.cells;
+	collapsingFirst = total.first;
+	collapsingLast = total.last;
+	collapsingFirstWord = total.firstWord;
+	collapsingLastWord = total.lastWord;
+	frontierCells = 0;
+}
 
-		affectedCells.pop();
-		depths.pop();
+//add grains to the cell at column of row of the layer storage, which stands for weight plate cells, listing it if it is new to the frontier
+inline void Sandpile::receive(int row, int column, int grains, int weight, LayerSums &sums)
+{
+	int r = row * layerStride + column;
+	if (incoming[r] == 0) {
+		frontier[r / 64] |= 1ULL << (r % 64);
+		frontierList.push_back({row, column});
+		sums.cells++;
+		sums.first = std::min(sums.first, row);
+		sums.last = std::max(sums.last, row);
+		sums.firstWord = std::min(sums.firstWord, column / 64);
+		sums.lastWord = std::max(sums.lastWord, column / 64);
+	}
+	incoming[r] += grains;
+	sums.size -= grains * weight;
+	sums.capacity += grains * weight;
+}
 
-		int x = dim.first, y = dim.second;
+//take the frontier found by a gather, listed or not
+void Sandpile::setFrontier(const LayerSums &total, bool listed)
+{
+	size += total.size;
+	capacity += total.capacity;
+	frontierCells = total.cells;
+	frontierFirst = total.first;
+	frontierLast = total.last;
+	frontierFirstWord = total.firstWord;
+	frontierLastWord = total.lastWord;
+	frontierListed = listed;
+}
+
+/*
+build the next frontier on the full plate: every neighbour of a collapsed cell
+receives one grain per topple of each of its neighbours.
+small layers push the grains of their listed collapsed cells to the neighbours, which lists the next frontier.
+larger ones pull them: every cell next to a collapsed cell, within the rows and words next to collapsed cells,
+adds up its neighbours' topples. then each row only writes its own cells, so rows can be gathered in parallel.
+*/
+void Sandpile::gatherPlate()
+{
+	if (collapsingListed && serialWork(collapsingCells * 4)) {
+		LayerSums total;
+		for (std::pair<int, int> cell : collapsingList) {
+			int i = cell.first, j = cell.second, n = toppled[i * layerStride + j];
+			if (i > 0)
+				receive(i - 1, j, n, 1, total);
+			if (i < width - 1)
+				receive(i + 1, j, n, 1, total);
+			if (j > 0)
+				receive(i, j - 1, n, 1, total);
+			if (j < height - 1)
+				receive(i, j + 1, n, 1, total);
+		}
+		setFrontier(total, true);
+		return;
+	}
+	int rowWords = layerStride / 64;
+	uint64_t lastMask = (height % 64 == 0) ? ~0ULL : (1ULL << (height % 64)) - 1;
+	int firstRow = std::max(0, collapsingFirst - 1), lastRow = std::min(width - 1, collapsingLast + 1);
+	int firstWord = std::max(0, collapsingFirstWord - 1), lastWord = std::min(rowWords - 1, collapsingLastWord + 1);
+	LayerSums total = sweepRows(firstRow, lastRow, collapsingCells * 4, [this, rowWords, lastMask, firstWord, lastWord](int first, int last, LayerSums &sums) {
+		for (int i = first; i < last; i++) {
+			const uint64_t *row = &collapsing[i * rowWords];
+			for (int k = firstWord; k <= lastWord; k++) {
+				uint64_t bits = (row[k] << 1) | (row[k] >> 1);
+				if (k > 0)
+					bits |= row[k - 1] >> 63;
+				if (k < rowWords - 1)
+					bits |= row[k + 1] << 63;
+				if (i > 0)
+					bits |= row[k - rowWords];
+				if (i < width - 1)
+					bits |= row[k + rowWords];
+				if (k == rowWords - 1)
+					bits &= lastMask;
+				if (bits == 0)
+					continue;
+				frontier[i * rowWords + k] = bits;
+				sums.first = std::min(sums.first, i);
+				sums.last = i;
+				sums.firstWord = std::min(sums.firstWord, k);
+				sums.lastWord = std::max(sums.lastWord, k);
+				while (bits != 0) {
+					int j = k * 64 + lowestBit(bits);
+					bits &= bits - 1;
+					int c = i * layerStride + j;
+					int n = 0;
+					if (i > 0)
+						n += toppled[c - layerStride];
+					if (i < width - 1)
+						n += toppled[c + layerStride];
+					if (j > 0)
+						n += toppled[c - 1];
+					if (j < height - 1)
+						n += toppled[c + 1];
+					incoming[c] = n;
+					sums.size -= n;
+					sums.capacity += n;
+					sums.cells++;
+				}
+			}
+		}
+	});
+	setFrontier(total, false);
+}
 
-		plate[x][y]++;
+//build the next frontier on the wedge, following the transfer edges of every collapsed cell
+void Sandpile::gatherWedge()
+{
+	LayerSums total;
+	auto send = [this, &total](int c) {
+		for (int e = edgeStart[c]; e < edgeStart[c + 1]; e++)
+			receive(0, edgeTarget[e], toppled[c], wedgeWeight[edgeTarget[e]], total);
+	};
+	if (collapsingListed) {
+		for (std::pair<int, int> cell : collapsingList)
+			send(cell.second);
+	} else {
+		for (int w = collapsingFirstWord; w <= collapsingLastWord; w++) {
+			uint64_t bits = collapsing[w];
+			while (bits != 0) {
+				send(w * 64 + lowestBit(bits));
+				bits &= bits - 1;
+			}
+		}
+	}
+	setFrontier(total, true);
+}
 
-		if (plate[x][y] % 4 == 0) {
-			//assume that all 4 will fall off, and then make it back up
-			size += 4;
-			capacity -= 4;
-			collapsingCells.push({x, y});
-			if (y != 0)
-				dropOne(x, y - 1, depth + 1, true);
-			if (y != height - 1)
-				dropOne(x, y + 1, depth + 1, true);
-			if (x != 0)
-				dropOne(x - 1, y, depth + 1, true);
-			if (x != width - 1)
-				dropOne(x + 1, y, depth + 1, true);
+/*
+expand the wedge into the full plate, only done when something actually reads the plate.
+every wedge cell is copied to the mirror images of its representative, which make up its orbit,
+so no cell has to look up its wedge index.
+*/
+void Sandpile::syncPlate()
+{
+	if (!reduced || !plateStale)
+		return;
+	for (std::size_t w = 0; w < wedge.size(); w++) {
+		int x = wedgeCells[w].first, y = wedgeCells[w].second, n = wedge[w];
+		const int xs[] = {x, (foldX) ? width - 1 - x : x};
+		const int ys[] = {y, (foldY) ? height - 1 - y : y};
+		for (int a : xs) {
+			for (int b : ys) {
+				plate[a][b] = n;
+				//the diagonal is only folded on square plates
+				if (foldDiag)
+					plate[b][a] = n;
+			}
 		}
 	}
-	currentDepth = depths.front();
+	plateStale = false;
+}
+
+/*
+drop and fully relax count sand grains at once, storing the size of each avalanche.
+the drop sites are drawn up front in the same order as update() would draw them,
+then every drop is relaxed speculatively on worker threads against the current plate.
+committing happens in order: a drop whose touched cells were not touched by any earlier drop of
+the batch read exactly the values it would have seen sequentially, so its result is kept.
+otherwise it is run again on the updated plate. either way the sizes match the sequential run.
+must be called between drops (no avalanche in progress).
+*/
+void Sandpile::dropBatch(int count, std::vector<int> &sizes)
+{
+	sites.resize(std::max(count, 0));
+	for (int i = 0; i < count; i++)
+		sites[i] = nextDropSite();
+	dropSites(sites, sizes);
+}
+
+//relax one drop at each of the given sites, in order, like dropBatch. used to replay recorded runs
+void Sandpile::dropSites(const std::vector<std::pair<int, int>> &sites, std::vector<int> &sizes)
+{
+	if (&sites != &this->sites)
+		this->sites = sites;
+	int count = (int) sites.size();
+	sizes.assign(count, 0);
+	avalanches.assign(count, Avalanche());
+	if (count <= 0)
+		return;
+	settleCollapsing();
+	if (reduced)
+		unfoldPlate();
+
+	int threads = std::min(workerCount(), count);
+	if ((int) overlays.size() < threads)
+		overlays.resize(threads);
+	std::vector<Speculation> results(count);
+	//with a single core there is nothing to overlap with, so every drop just runs in order below
+	if (threads > 1) {
+		WorkerPool::shared().run(threads, [this, threads, count, &sites, &results](int t) {
+			for (int i = t; i < count; i += threads)
+				speculate(sites[i].first, sites[i].second, overlays[t], results[i]);
+		});
+	}
+
+	if (claimed.size() != (std::size_t) (width * height)) {
+		claimed.assign(width * height, 0);
+		batchGeneration = 0;
+	}
+	batchGeneration++;
+	for (int i = 0; i < count; i++) {
+		bool overlap = threads == 1;
+		for (std::size_t k = 0; !overlap && k < results[i].touched.size(); k++)
+			overlap = claimed[results[i].touched[k]] == batchGeneration;
+		if (overlap)
+			speculate(sites[i].first, sites[i].second, overlays[0], results[i]);
+		commit(results[i]);
+		sizes[i] = results[i].size;
+		avalanches[i] = results[i].avalanche;
+	}
+
+	drops += count;
+	size = sizes.back();
+	avalanche = avalanches.back();
+}
+
+//replace the plate by stable cells of the same dimensions. must be called between drops
+void Sandpile::setPlate(const std::vector<std::vector<int>> &cells)
+{
+	releaseWedge();
+	foldFailed = false;
+	plate = cells;
+	capacity = 0;
+	for (int i = 0; i < width; i++)
+		for (int j = 0; j < height; j++)
+			capacity += plate[i][j];
+	resetFrontier();
 }
 
 void Sandpile::fillRand()
 {
+	releaseWedge();
+	foldFailed = false;
 	capacity = 0;
 	for (int i = 0; i < width; i++) {
 		for (int j = 0; j < height; j++) {
-			plate[i][j] = std::rand() % 4;
+			plate[i][j] = rng() % 4;
 			capacity += plate[i][j];
 		}
 	}
-	resetQueues();
+	resetFrontier();
 }
 
 void Sandpile::fillValue(int n)
 {
+	releaseWedge();
+	foldFailed = false;
 	for (int i = 0; i < width; i++)
 		for (int j = 0; j < height; j++)
 			plate[i][j] = n;
 	capacity = width * height * n;
-	resetQueues();
+	resetFrontier();
+}
+
+//the identity of the sandpile group is stab(6 - stab(6)), with 6 = 2 * (maximum stable height)
+void Sandpile::fillIdentity()
+{
+	fillValue(6);
+	stabilize();
+	for (int i = 0; i < width; i++)
+		for (int j = 0; j < height; j++)
+			plate[i][j] = 6 - plate[i][j];
+	stabilize();
+}
+
+/*
+random heights on top of the fullest stable plate (3 everywhere), relaxed.
+adding sand to a recurrent configuration and relaxing always gives a recurrent one, so this starts
+in the stationary state of random drops instead of having to build it up from an empty plate.
+*/
+void Sandpile::fillRelaxed()
+{
+	releaseWedge();
+	foldFailed = false;
+	for (int i = 0; i < width; i++)
+		for (int j = 0; j < height; j++)
+			plate[i][j] = 3 + rng() % 4;
+	stabilize();
+}
+
+//relax the whole plate at once with the bit-sliced engine. must be called between drops
+void Sandpile::stabilize()
+{
+	settleCollapsing();
+	syncPlate();
+	releaseWedge();
+	BitPlate bits(width, height);
+	foldFailed = false;
+	bits.load(plate);
+	bits.stabilize();
+	bits.store(plate);
+	capacity = 0;
+	for (int i = 0; i < width; i++)
+		for (int j = 0; j < height; j++)
+			capacity += plate[i][j];
+	resetFrontier();
 }
 
 void Sandpile::resize()
 {
 	if (width > 1000 || height > 1000)
 		throw std::invalid_argument("too large!");
+	releaseWedge();
+	foldFailed = false;
 	plate = std::vector<std::vector<int>>(width, std::vector<int>(height, 0));
-	resetQueues();
+	resetFrontier();
 }
 
-void Sandpile::dropOne(int x, int y, int depth, bool collapse)
+std::pair<int, int> Sandpile::nextDropSite()
 {
-	affectedCells.push({x, y});
-	depths.push(depth);
-	if (collapse)
-		size--;
-	capacity++;
+	if (center)
+		return {width / 2, height / 2};
+	if (source.width == width && source.height == height && !source.empty())
+		return source.next(rng);
+	int x = rng() % width;
+	return {x, (int) (rng() % height)};
 }
 
-void Sandpile::resetQueues()
+//whether a pass over work cells is done on the calling thread alone
+bool Sandpile::serialWork(int work) const
 {
-	std::queue<std::pair<int, int>>().swap(affectedCells);
-	std::queue<std::pair<int, int>>().swap(collapsingCells);
-	std::queue<int>().swap(depths);
-}
\ No newline at end of file
+	return work < parallelWork || workerCount() == 1;
+}
+
+int Sandpile::workerCount() const
+{
+	if (threads > 0)
+		return threads;
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+relax a single drop on a private overlay of the plate.
+cells are copied into the overlay the first time they are read, which also records them as touched.
+the avalanche runs in waves like the layers of update(): every cell of a wave topples, then its neighbours
+receive the grains and the ones reaching 4 make up the next wave. so the shape comes out the same.
+*/
+void Sandpile::speculate(int x, int y, Overlay &overlay, Speculation &result) const
+{
+	if (overlay.cells.size() != (std::size_t) (width * height)) {
+		overlay.cells.assign(width * height, OverlayCell());
+		overlay.generation = 0;
+	}
+	overlay.generation++;
+	result.touched.clear();
+	result.values.clear();
+	//locals, so the stores into the overlay can't make the compiler reload them
+	const int width = this->width, height = this->height, generation = overlay.generation;
+	OverlayCell *cells = overlay.cells.data();
+	int size = 0;
+	Avalanche shape;
+
+	auto read = [&](int i, int j) -> int & {
+		int c = i * height + j;
+		if (cells[c].stamp != generation) {
+			cells[c].stamp = generation;
+			cells[c].value = plate[i][j];
+			result.touched.push_back(c);
+		}
+		return cells[c].value;
+	};
+
+	auto give = [&](int i, int j, int topples) {
+		size -= topples;
+		int &neighbour = read(i, j);
+		neighbour += topples;
+		//every cell of the wave is below 4 by now, so a cell joins the next wave exactly once
+		if (neighbour >= 4 && neighbour - topples < 4)
+			overlay.next.push_back(i * height + j);
+	};
+
+	std::vector<int> &wave = overlay.wave;
+	wave.clear();
+	if (++read(x, y) >= 4)
+		wave.push_back(x * height + y);
+	while (wave.size() > 0) {
+		shape.duration++;
+		overlay.topples.resize(wave.size());
+		for (std::size_t k = 0; k < wave.size(); k++) {
+			int &cell = cells[wave[k]].value;
+			overlay.topples[k] = cell / 4;
+			cell %= 4;
+		}
+		overlay.next.clear();
+		for (std::size_t k = 0; k < wave.size(); k++) {
+			int c = wave[k], topples = overlay.topples[k];
+			int i = c / height, j = c % height;
+			//same bookkeeping as update(): 4 grains per topple, minus the ones that stay on the plate
+			size += 4 * topples;
+			shape.topples += topples;
+			if (cells[c].visited != generation) {
+				cells[c].visited = generation;
+				shape.area++;
+				shape.sumX += i;
+				shape.sumY += j;
+				shape.sumSquares += (long long) i * i + (long long) j * j;
+			}
+			if (j > 0)
+				give(i, j - 1, topples);
+			if (j < height - 1)
+				give(i, j + 1, topples);
+			if (i > 0)
+				give(i - 1, j, topples);
+			if (i < width - 1)
+				give(i + 1, j, topples);
+		}
+		wave.swap(overlay.next);
+	}
+	result.size = size;
+	result.avalanche = shape;
+
+	for (int c : result.touched)
+		result.values.push_back(cells[c].value);
+}
+
+//write a speculated drop into the plate and claim its cells for the rest of the batch
+void Sandpile::commit(const Speculation &result)
+{
+	for (std::size_t k = 0; k < result.touched.size(); k++) {
+		int c = result.touched[k];
+		plate[c / height][c % height] = result.values[k];
+		claimed[c] = batchGeneration;
+	}
+	//one grain came in, size grains fell off the edge
+	capacity += 1 - result.size;
+}
+
+//allocate empty layer storage for the plate, or for the wedge while it is active
+void Sandpile::resetFrontier()
+{
+	layerRows = (reduced) ? 1 : width;
+	int length = (reduced) ? (int) wedge.size() : height;
+	layerStride = (length + 63) / 64 * 64;
+	frontier.assign(layerRows * layerStride / 64, 0);
+	collapsing.assign(layerRows * layerStride / 64, 0);
+	incoming.assign(layerRows * layerStride, 0);
+	toppled.assign(layerRows * layerStride, 0);
+	visited.assign(layerRows * layerStride, 0);
+	visitGeneration = 0;
+	frontierCells = 0;
+	collapsingCells = 0;
+	frontierList.clear();
+	collapsingList.clear();
+	frontierListed = collapsingListed = false;
+}
+
+//map any plate cell to the index of its representative in the wedge
+int Sandpile::wedgeIndex(int x, int y) const
+{
+	if (foldX)
+		x = std::min(x, width - 1 - x);
+	if (foldY)
+		y = std::min(y, height - 1 - y);
+	if (foldDiag) {
+		if (x > y)
+			std::swap(x, y);
+		return y * (y + 1) / 2 + x;
+	}
+	return x * wedgeHeight + y;
+}
+
+/*
+the center cell is only fixed by a reflection along an axis of odd length,
+and by the diagonal reflection if the plate is square.
+build the weights (orbit sizes) and the grain transfer edges between wedge cells.
+an edge c -> r is added once for every neighbour of r that lies in the orbit of c,
+so when c topples r receives exactly what each cell of its orbit would receive on the full plate.
+*/
+void Sandpile::buildWedge()
+{
+	foldX = width % 2 == 1;
+	foldY = height % 2 == 1;
+	foldDiag = width == height;
+	wedgeWidth = (foldX) ? (width + 1) / 2 : width;
+	wedgeHeight = (foldY) ? (height + 1) / 2 : height;
+	int cells = (foldDiag) ? wedgeWidth * (wedgeWidth + 1) / 2 : wedgeWidth * wedgeHeight;
+
+	wedge.assign(cells, 0);
+	wedgeWeight.assign(cells, 0);
+	wedgeCells.assign(cells, {0, 0});
+	orbitX.assign(cells, 0);
+	orbitY.assign(cells, 0);
+	orbitSquares.assign(cells, 0);
+	for (int i = 0; i < width; i++) {
+		for (int j = 0; j < height; j++) {
+			int w = wedgeIndex(i, j);
+			//the first cell met is the one with the smallest coordinates, which is the canonical one
+			if (wedgeWeight[w] == 0)
+				wedgeCells[w] = {i, j};
+			wedgeWeight[w]++;
+			orbitX[w] += i;
+			orbitY[w] += j;
+			orbitSquares[w] += (long long) i * i + (long long) j * j;
+		}
+	}
+
+	const int dx[] = {0, 0, -1, 1};
+	const int dy[] = {-1, 1, 0, 0};
+	edgeStart.assign(cells + 1, 0);
+	for (int r = 0; r < cells; r++) {
+		for (int k = 0; k < 4; k++) {
+			int x = wedgeCells[r].first + dx[k], y = wedgeCells[r].second + dy[k];
+			if (x >= 0 && x < width && y >= 0 && y < height)
+				edgeStart[wedgeIndex(x, y) + 1]++;
+		}
+	}
+	for (int c = 0; c < cells; c++)
+		edgeStart[c + 1] += edgeStart[c];
+	edgeTarget.assign(edgeStart[cells], 0);
+	std::vector<int> fill(edgeStart.begin(), edgeStart.end() - 1);
+	for (int r = 0; r < cells; r++) {
+		for (int k = 0; k < 4; k++) {
+			int x = wedgeCells[r].first + dx[k], y = wedgeCells[r].second + dy[k];
+			if (x >= 0 && x < width && y >= 0 && y < height)
+				edgeTarget[fill[wedgeIndex(x, y)]++] = r;
+		}
+	}
+}
+
+/*
+switch to the reduced storage, if the plate has a symmetry and is currently invariant under it.
+the plate is compared with its mirror images before anything is allocated, and a plate that isn't invariant
+is not looked at again until it is refilled (center drops keep an asymmetric plate asymmetric).
+*/
+bool Sandpile::foldPlate()
+{
+	bool mirrorX = width % 2 == 1, mirrorY = height % 2 == 1, mirrorDiag = width == height;
+	bool invariant = mirrorX || mirrorY || mirrorDiag;
+	for (int i = 0; invariant && i < width; i++) {
+		for (int j = 0; invariant && j < height; j++) {
+			int n = plate[i][j];
+			invariant = (!mirrorX || plate[width - 1 - i][j] == n)
+				&& (!mirrorY || plate[i][height - 1 - j] == n)
+				&& (!mirrorDiag || plate[j][i] == n);
+		}
+	}
+	if (!invariant) {
+		foldFailed = true;
+		return false;
+	}
+	buildWedge();
+	for (std::size_t w = 0; w < wedge.size(); w++)
+		wedge[w] = plate[wedgeCells[w].first][wedgeCells[w].second];
+	reduced = true;
+	plateStale = false;
+	resetFrontier();
+	return true;
+}
+
+void Sandpile::unfoldPlate()
+{
+	syncPlate();
+	releaseWedge();
+	resetFrontier();
+}
+
+//leave the reduced mode and free its storage, the plate must be up to date or about to be overwritten
+void Sandpile::releaseWedge()
+{
+	reduced = false;
+	std::vector<int>().swap(wedge);
+	std::vector<int>().swap(wedgeWeight);
+	std::vector<int>().swap(edgeStart);
+	std::vector<int>().swap(edgeTarget);
+	std::vector<std::pair<int, int>>().swap(wedgeCells);
+	std::vector<long long>().swap(orbitX);
+	std::vector<long long>().swap(orbitY);
+	std::vector<long long>().swap(orbitSquares);
+}
@@ -0,0 +1,295 @@
+#include "selftest.hpp"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool sameShape(const Avalanche &a, const Avalanche &b)
+{
+	return a.area == b.area && a.duration == b.duration && a.topples == b.topples
+	       && a.sumX == b.sumX && a.sumY == b.sumY && a.sumSquares == b.sumSquares;
+}
+
+//a pile with random drops, cleared or relaxed. piles made with the same arguments drop at the same sites
+static Sandpile makePile(int width, int height, bool relaxed)
+{
+	Sandpile pile(width, height, 1);
+	pile.center = false;
+	if (relaxed)
+		pile.fillRelaxed();
+	return pile;
+}
+
+/*
+drop the same random grains one at a time with update() and in batches with dropBatch().
+the size and shape of every avalanche, the final plate and the number of grains must all match exactly.
+*/
+static bool checkBatches(int width, int height, bool relaxed, int drops, int threads)
+{
+	Sandpile serial = makePile(width, height, relaxed);
+	std::vector<int> sizes;
+	std::vector<Avalanche> shapes;
+	for (int i = 0; i < drops; i++) {
+		do {
+			serial.update();
+		} while (!serial.idle());
+		sizes.push_back(serial.size);
+		shapes.push_back(serial.avalanche);
+	}
+
+	Sandpile batched = makePile(width, height, relaxed);
+	batched.threads = threads;
+	std::vector<int> batch;
+	int mismatches = 0;
+	for (int done = 0; done < drops; done += (int) batch.size()) {
+		batched.dropBatch(std::min(1 << 12, drops - done), batch);
+		for (std::size_t k = 0; k < batch.size(); k++)
+			if (batch[k] != sizes[done + k] || !sameShape(batched.avalanches[k], shapes[done + k]))
+				mismatches++;
+	}
+
+	//cells that toppled in the last update still hold n >= 4 until the next one
+	bool samePlate = serial.capacity == batched.capacity;
+	for (int i = 0; i < width; i++)
+		for (int j = 0; j < height; j++)
+			samePlate = samePlate && serial.plate[i][j] % 4 == batched.plate[i][j];
+
+	std::cout << "batch " << width << "x" << height << (relaxed ? " relaxed" : " cleared") << ", " << drops << " drops, "
+	          << ((threads > 0) ? std::to_string(threads) : "all") << " threads: ";
+	if (mismatches == 0 && samePlate) {
+		std::cout << "ok" << std::endl;
+		return true;
+	}
+	std::cout << "FAILED, " << mismatches << " avalanches differ" << (samePlate ? "" : ", the plates differ") << std::endl;
+	return false;
+}
+
+//random drops per second with update(), and with batches on one and on all cores
+static void timeBatches(int width, int height, int drops)
+{
+	Sandpile serial = makePile(width, height, true);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < drops; i++) {
+		do {
+			serial.update();
+		} while (!serial.idle());
+	}
+	double serialRate = drops / secondsSince(start);
+
+	double rates[2];
+	for (int t = 0; t < 2; t++) {
+		Sandpile batched = makePile(width, height, true);
+		batched.threads = (t == 0) ? 1 : 0;
+		std::vector<int> sizes;
+		start = std::chrono::steady_clock::now();
+		for (int done = 0; done < drops; done += (int) sizes.size())
+			batched.dropBatch(std::min(1 << 12, drops - done), sizes);
+		rates[t] = drops / secondsSince(start);
+	}
+	std::cout << "random drops per second on " << width << "x" << height << " relaxed: update() " << (long long) serialRate
+	          << ", batches on 1 core " << (long long) rates[0] << " (" << rates[0] / serialRate << "x)"
+	          << ", on " << std::max(1u, std::thread::hardware_concurrency()) << " cores " << (long long) rates[1]
+	          << " (" << rates[1] / serialRate << "x)" << std::endl;
+}
+
+//plain relaxation, one cell at a time, returning the number of topples
+static long long relaxPlain(std::vector<std::vector<int>> &plate)
+{
+	int width = (int) plate.size(), height = (int) plate[0].size();
+	std::vector<std::pair<int, int>> stack;
+	for (int i = 0; i < width; i++)
+		for (int j = 0; j < height; j++)
+			if (plate[i][j] >= 4)
+				stack.push_back({i, j});
+	long long topples = 0;
+	while (!stack.empty()) {
+		int i = stack.back().first, j = stack.back().second;
+		stack.pop_back();
+		int t = plate[i][j] / 4;
+		plate[i][j] %= 4;
+		topples += t;
+		const int di[] = {0, 0, -1, 1};
+		const int dj[] = {-1, 1, 0, 0};
+		for (int d = 0; d < 4; d++) {
+			int ni = i + di[d], nj = j + dj[d];
+			if (ni < 0 || ni >= width || nj < 0 || nj >= height)
+				continue;
+			plate[ni][nj] += t;
+			if (plate[ni][nj] >= 4 && plate[ni][nj] - t < 4)
+				stack.push_back({ni, nj});
+		}
+	}
+	return topples;
+}
+
+static std::vector<std::vector<int>> randomPlate(int width, int height, std::mt19937 &rng)
+{
+	std::vector<std::vector<int>> plate(width, std::vector<int>(height));
+	for (std::vector<int> &column : plate)
+		for (int &cell : column)
+			cell = rng() % 8;
+	return plate;
+}
+
+/*
+drop grains in the center of a cleared or identity plate, once with the symmetric (wedge) storage and once with the full plate.
+after every layer the plates, the sizes and the avalanche shapes so far must match, and after every drop
+the plate must match relaxPlain() adding the grain to a plain copy.
+*/
+static bool checkCenter(int width, int height, bool identity, int drops)
+{
+	Sandpile folded(width, height, 1), full(width, height, 1);
+	folded.symmetric = true;
+	if (identity) {
+		folded.fillIdentity();
+		full.fillIdentity();
+	}
+	std::vector<std::vector<int>> plain = full.plate;
+	int layers = 0, mismatches = 0;
+	bool sameDrops = true;
+	for (int i = 0; i < drops; i++) {
+		do {
+			folded.update();
+			full.update();
+			folded.syncPlate();
+			layers++;
+			if (folded.plate != full.plate || folded.size != full.size || !sameShape(folded.avalanche, full.avalanche))
+				mismatches++;
+		} while (!folded.idle() && !full.idle());
+		plain[width / 2][height / 2]++;
+		relaxPlain(plain);
+		sameDrops = sameDrops && folded.idle() && full.idle();
+		for (int x = 0; x < width; x++)
+			for (int y = 0; y < height; y++)
+				sameDrops = sameDrops && full.plate[x][y] % 4 == plain[x][y];
+	}
+
+	std::cout << "center " << width << "x" << height << (identity ? " identity" : " cleared") << ", " << drops << " drops, symmetric: ";
+	if (mismatches == 0 && sameDrops) {
+		std::cout << "ok" << std::endl;
+		return true;
+	}
+	std::cout << "FAILED, " << mismatches << " of " << layers << " layers differ" << (sameDrops ? "" : ", the relaxed plates differ") << std::endl;
+	return false;
+}
+
+/*
+relax random plates of heights 0 to 7 with the bit-plane engine and with relaxPlain(), and check that
+the plates and the numbers of topples are the same. also checks fillIdentity() against stab(6 - stab(6)).
+*/
+static bool checkBitPlate(int width, int height)
+{
+	std::mt19937 rng(width * 1000 + height);
+	bool ok = true;
+	for (int k = 0; k < 5; k++) {
+		std::vector<std::vector<int>> plain = randomPlate(width, height, rng), bitwise = plain;
+		long long plainTopples = relaxPlain(plain);
+		BitPlate bits(width, height);
+		bits.load(bitwise);
+		long long bitTopples = bits.stabilize();
+		bits.store(bitwise);
+		ok = ok && plain == bitwise && plainTopples == bitTopples;
+	}
+
+	std::vector<std::vector<int>> identity(width, std::vector<int>(height, 6));
+	relaxPlain(identity);
+	for (std::vector<int> &column : identity)
+		for (int &cell : column)
+			cell = 6 - cell;
+	relaxPlain(identity);
+	Sandpile pile(width, height, 1);
+	pile.fillIdentity();
+	bool identityOk = pile.plate == identity;
+
+	std::cout << "bit planes " << width << "x" << height << ": ";
+	if (ok && identityOk) {
+		std::cout << "ok" << std::endl;
+		return true;
+	}
+	std::cout << "FAILED" << (ok ? "" : ", relaxed plates or topples differ") << (identityOk ? "" : ", identity differs") << std::endl;
+	return false;
+}
+
+//topples per second of the bit-plane engine and of relaxPlain(), on the same random plate
+static void timeBitPlate(int width, int height)
+{
+	std::mt19937 rng(1);
+	std::vector<std::vector<int>> plain = randomPlate(width, height, rng), bitwise = plain;
+	auto start = std::chrono::steady_clock::now();
+	long long topples = relaxPlain(plain);
+	double plainRate = topples / secondsSince(start);
+	start = std::chrono::steady_clock::now();
+	BitPlate bits(width, height);
+	bits.load(bitwise);
+	bits.stabilize();
+	bits.store(bitwise);
+	double bitRate = topples / secondsSince(start);
+	std::cout << "topples per second relaxing a random " << width << "x" << height << " plate: one cell at a time "
+	          << (long long) plainRate << ", bit planes " << (long long) bitRate << " (" << bitRate / plainRate << "x)" << std::endl;
+}
+
+//time to draw a random site from an alias table source, next to a plain uniform draw
+static void timeDropSource(int width, int height, int draws)
+{
+	DropSource source;
+	source.resize(width, height);
+	source.addGaussian((width - 1) / 2.0, (height - 1) / 2.0, 0.15 * std::max(width, height));
+	std::mt19937 rng(1);
+	//summed up and printed, so the draws can't be optimized away
+	long long sum = 0;
+	source.next(rng);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < draws; i++) {
+		std::pair<int, int> site = source.next(rng);
+		sum += site.first + site.second;
+	}
+	double aliasTime = secondsSince(start) / draws;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < draws; i++) {
+		int x = rng() % width;
+		sum += x + (int) (rng() % height);
+	}
+	double uniformTime = secondsSince(start) / draws;
+	std::cout << "nanoseconds per random site on " << width << "x" << height << ": gaussian alias table "
+	          << aliasTime * 1e9 << ", uniform " << uniformTime * 1e9 << " (checksum " << sum << ")" << std::endl;
+}
+
+int runSelftest(const std::string &drops)
+{
+	int n;
+	try {
+		n = std::stoi(drops);
+		if (n < 1)
+			throw std::runtime_error("bad drop count " + drops);
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	bool ok = true;
+	//widths around a word of the layer bitsets, with one and with several worker threads
+	const int sizes[][2] = {{64, 64}, {63, 65}, {100, 100}};
+	for (const int *size : sizes) {
+		for (bool relaxed : {false, true}) {
+			ok = checkBatches(size[0], size[1], relaxed, n, 1) && ok;
+			ok = checkBatches(size[0], size[1], relaxed, n, 4) && ok;
+		}
+	}
+	//center drops with the symmetric storage: odd, even and non-square plates, which fold along different axes
+	const int centerSizes[][2] = {{51, 51}, {50, 50}, {51, 31}, {40, 31}};
+	for (const int *size : centerSizes) {
+		ok = checkCenter(size[0], size[1], false, std::min(n, 2000)) && ok;
+		ok = checkCenter(size[0], size[1], true, std::min(n, 200)) && ok;
+	}
+	//widths that end in a partial word, and plates of a single row or column
+	const int bitSizes[][2] = {{63, 63}, {65, 40}, {100, 100}, {1, 70}, {130, 1}, {129, 3}};
+	for (const int *size : bitSizes)
+		ok = checkBitPlate(size[0], size[1]) && ok;
+	timeBatches(100, 100, n);
+	timeBitPlate(200, 200);
+	timeDropSource(100, 100, 10000000);
+
+	std::cout << (ok ? "all checks passed" : "some checks FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
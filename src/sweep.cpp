@@ -0,0 +1,247 @@
+#include "sweep.hpp"
+
+//directory name of the job, also its key in the manifest. holds the base seed, so jobs of another seed are never taken as done
+std::string SweepJob::name() const
+{
+	return std::to_string(width) + "x" + std::to_string(height) + "_" + (center ? "center" : "random") + "_" + fill + "_" + std::to_string(drops) + (skipWarmup ? "_skip" : "")
+	       + "_seed" + std::to_string(baseSeed);
+}
+
+//seed of the simulation, from the job's own parameters so it stays the same when the spec is edited or reordered
+unsigned int SweepJob::seed() const
+{
+	//fnv-1a hash of the name, which includes the base seed
+	uint64_t hash = 14695981039346656037ULL;
+	for (char c : name()) {
+		hash ^= (unsigned char) c;
+		hash *= 1099511628211ULL;
+	}
+	return (unsigned int) (hash ^ (hash >> 32));
+}
+
+//rough amount of work, used to start the largest jobs first
+long long SweepJob::cost() const
+{
+	return (long long) width * height * drops;
+}
+
+//a positive whole number of drops
+static int parseDrops(const std::string &value)
+{
+	std::size_t end = 0;
+	int n = 0;
+	try {
+		n = std::stoi(value, &end);
+	} catch (const std::exception &) {
+		end = 0;
+	}
+	if (end == 0 || end != value.size() || n <= 0)
+		throw std::runtime_error("bad drop count " + value);
+	return n;
+}
+
+/*
+read a sweep spec. every line is a key followed by '=' and a list of values, '#' starts a comment:
+	size = 20x20 50x50
+	mode = center random
+	fill = clear random identity relaxed
+	warmup = keep skip
+	drops = 10000 100000
+	seed = 1
+the jobs are all combinations of the values. mode, fill, warmup and seed are optional.
+with warmup = skip, the drops before the run is stationary are not recorded (but count towards drops).
+*/
+std::vector<SweepJob> readSweepSpec(const std::string &path)
+{
+	std::ifstream fs(path);
+	if (!fs)
+		throw std::runtime_error("could not open sweep spec " + path);
+
+	std::vector<std::pair<int, int>> sizes;
+	std::vector<bool> modes;
+	std::vector<std::string> fills;
+	std::vector<bool> warmups;
+	std::vector<int> drops;
+	unsigned int seed = 1;
+
+	std::string line;
+	while (std::getline(fs, line)) {
+		line = line.substr(0, line.find('#'));
+		std::size_t eq = line.find('=');
+		if (eq == std::string::npos)
+			continue;
+		std::istringstream key(line.substr(0, eq)), values(line.substr(eq + 1));
+		std::string name, value;
+		key >> name;
+		while (values >> value) {
+			if (name == "size") {
+				std::size_t x = value.find('x');
+				if (x == std::string::npos)
+					throw std::runtime_error("bad size " + value);
+				int w = std::stoi(value.substr(0, x)), h = std::stoi(value.substr(x + 1));
+				if (w < 1 || h < 1 || w > 1000 || h > 1000)
+					throw std::runtime_error("bad size " + value);
+				sizes.push_back({w, h});
+			} else if (name == "mode") {
+				if (value != "center" && value != "random")
+					throw std::runtime_error("bad mode " + value);
+				modes.push_back(value == "center");
+			} else if (name == "fill") {
+				if (value != "clear" && value != "random" && value != "identity" && value != "relaxed")
+					throw std::runtime_error("bad fill " + value);
+				fills.push_back(value);
+			} else if (name == "warmup") {
+				if (value != "keep" && value != "skip")
+					throw std::runtime_error("bad warmup " + value);
+				warmups.push_back(value == "skip");
+			} else if (name == "drops") {
+				drops.push_back(parseDrops(value));
+			} else if (name == "seed") {
+				std::size_t end = 0;
+				try {
+					seed = std::stoul(value, &end);
+				} catch (const std::exception &) {
+					end = 0;
+				}
+				if (end == 0 || end != value.size())
+					throw std::runtime_error("bad seed " + value);
+			} else {
+				throw std::runtime_error("unknown key " + name);
+			}
+		}
+	}
+	if (sizes.empty() || drops.empty())
+		throw std::runtime_error("sweep spec needs at least one size and one drop count");
+	if (modes.empty())
+		modes.push_back(true);
+	if (fills.empty())
+		fills.push_back("clear");
+	if (warmups.empty())
+		warmups.push_back(false);
+
+	std::vector<SweepJob> jobs;
+	for (auto &size : sizes)
+		for (bool center : modes)
+			for (std::string &fill : fills)
+				for (bool skip : warmups)
+					for (int n : drops)
+						jobs.push_back({size.first, size.second, center, fill, skip, n, seed});
+	return jobs;
+}
+
+//simulate one job from scratch and write its data, the same files as "export data"
+static bool runJob(const SweepJob &job, const std::filesystem::path &dir)
+{
+	Sandpile pile(job.width, job.height, job.seed());
+	//the sweep already keeps every core busy
+	pile.threads = 1;
+	pile.center = job.center;
+	//random fills are never symmetric, only the cleared plate and the identity can be folded
+	pile.symmetric = job.center && (job.fill == "clear" || job.fill == "identity");
+	std::string reset = "cleared";
+	if (job.fill == "random") {
+		pile.fillRand();
+		reset = "randomized";
+	} else if (job.fill == "identity") {
+		pile.fillIdentity();
+		reset = "identity";
+	} else if (job.fill == "relaxed") {
+		pile.fillRelaxed();
+		reset = "relaxed";
+	} else {
+		pile.fillValue(0);
+	}
+
+	SizeStats stats;
+	stats.skipWarmup = job.skipWarmup;
+	stats.begin(job.width * job.height, pile.capacity);
+	if (job.center) {
+		while (pile.drops < job.drops) {
+			do {
+				pile.update();
+			} while (!pile.idle());
+			stats.add(pile.size, pile.avalanche);
+		}
+	} else {
+		std::vector<int> sizes;
+		while (pile.drops < job.drops) {
+			pile.dropBatch(std::min(1 << 12, job.drops - pile.drops), sizes);
+			for (std::size_t i = 0; i < sizes.size(); i++)
+				stats.add(sizes[i], pile.avalanches[i]);
+		}
+	}
+
+	std::filesystem::create_directories(dir);
+	SimInfo info = {reset, job.width, job.height, pile.drops, job.center ? pile.drops : 0, job.center ? 0 : pile.drops};
+	return exportData(dir, info, stats);
+}
+
+/*
+run every job of the spec that is not in outDir/manifest.txt yet, largest first, one job per core.
+a job is added to the manifest only once its results are written, so an interrupted sweep
+resumes by running the same command again.
+*/
+int runSweep(const std::string &specPath, const std::filesystem::path &outDir)
+{
+	std::vector<SweepJob> jobs;
+	try {
+		jobs = readSweepSpec(specPath);
+		std::filesystem::create_directories(outDir);
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::filesystem::path manifestPath = outDir / "manifest.txt";
+	std::set<std::string> done;
+	std::ifstream manifestIn(manifestPath);
+	std::string line;
+	while (std::getline(manifestIn, line))
+		done.insert(line);
+	manifestIn.close();
+
+	std::vector<SweepJob> pending;
+	for (SweepJob &job : jobs)
+		if (done.find(job.name()) == done.end())
+			pending.push_back(job);
+	std::stable_sort(pending.begin(), pending.end(), [](const SweepJob &a, const SweepJob &b) {
+		return a.cost() > b.cost();
+	});
+	std::cout << jobs.size() - pending.size() << " of " << jobs.size() << " jobs already done" << std::endl;
+
+	std::ofstream manifest(manifestPath, std::ios::out | std::ios::app);
+	std::mutex manifestMutex;
+	std::atomic<int> next(0);
+	std::atomic<int> failed(0);
+	int finished = 0;
+
+	int threads = std::min((int) pending.size(), (int) std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&]() {
+			for (int i = next++; i < (int) pending.size(); i = next++) {
+				const SweepJob &job = pending[i];
+				//a job that can't write its results (or runs out of memory) fails on its own, the others keep going
+				bool ok = false;
+				try {
+					ok = runJob(job, outDir / job.name());
+				} catch (const std::exception &e) {
+					std::lock_guard<std::mutex> lock(manifestMutex);
+					std::cerr << job.name() << ": " << e.what() << std::endl;
+				}
+				std::lock_guard<std::mutex> lock(manifestMutex);
+				finished++;
+				if (ok) {
+					manifest << job.name() << std::endl;
+					std::cout << "[" << finished << "/" << pending.size() << "] " << job.name() << std::endl;
+				} else {
+					failed++;
+					std::cerr << "[" << finished << "/" << pending.size() << "] " << job.name() << " failed" << std::endl;
+				}
+			}
+		});
+	}
+	for (std::thread &worker : workers)
+		worker.join();
+	return (failed > 0) ? 1 : 0;
+}
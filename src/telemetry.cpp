@@ -0,0 +1,259 @@
+#include "telemetry.hpp"
+
+#if defined _WIN64 || defined _WIN32
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+TelemetryServer::TelemetryServer()
+	: interval(0.1), listener(-1), haveBase(false), lastWidth(0), lastHeight(0), lastDrops(0)
+{
+}
+
+TelemetryServer::~TelemetryServer()
+{
+	stop();
+}
+
+//listen on a socket file at path, replacing a stale socket left by an earlier run
+bool TelemetryServer::start(const std::string &path)
+{
+	stop();
+#if defined _WIN64 || defined _WIN32
+	std::cerr << "Telemetry needs unix domain sockets, which are not supported on this platform." << std::endl;
+	return false;
+#else
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Bad telemetry socket path " << path << std::endl;
+		return false;
+	}
+	path.copy(addr.sun_path, path.size());
+
+	struct stat info;
+	if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+		unlink(path.c_str());
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(listener, 8) != 0
+	    || fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK) != 0) {
+		std::cerr << "Could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+		if (listener >= 0)
+			close(listener);
+		listener = -1;
+		return false;
+	}
+	this->path = path;
+	haveBase = false;
+	lastTime = std::chrono::steady_clock::now();
+	return true;
+#endif
+}
+
+void TelemetryServer::stop()
+{
+#if !(defined _WIN64 || defined _WIN32)
+	for (Client &client : clients)
+		closeClient(client);
+	clients.clear();
+	if (listener >= 0) {
+		close(listener);
+		unlink(path.c_str());
+	}
+#endif
+	listener = -1;
+}
+
+bool TelemetryServer::running() const
+{
+	return listener >= 0;
+}
+
+/*
+called from the simulation loop as often as convenient, it does nothing but retry queued output
+until interval has passed since the last message.
+the plate and histogram are compared to the last message's, so a delta costs one pass over both.
+*/
+void TelemetryServer::publish(Sandpile &pile, const SizeStats &stats)
+{
+#if !(defined _WIN64 || defined _WIN32)
+	if (listener < 0)
+		return;
+	auto now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - lastTime).count();
+	if (elapsed < interval) {
+		for (Client &client : clients)
+			if (client.sent < client.pending.size() && !flush(client))
+				closeClient(client);
+		clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client &c) { return c.fd < 0; }), clients.end());
+		return;
+	}
+	acceptClients();
+	if (clients.empty()) {
+		//nobody to send a delta to, whoever connects next starts with a keyframe anyway
+		haveBase = false;
+		lastTime = now;
+		return;
+	}
+
+	pile.syncPlate();
+	long long rate = haveBase ? std::max(0LL, std::llround((pile.drops - lastDrops) / elapsed)) : 0;
+	bool sameSize = haveBase && pile.width == lastWidth && pile.height == lastHeight;
+	std::vector<unsigned char> delta, keyframe;
+
+	if (sameSize) {
+		header(delta, pile, stats, rate);
+		std::vector<unsigned char> entries;
+		int count = 0, previous = 0;
+		std::size_t n = std::max(stats.freq.size(), lastFreq.size());
+		for (std::size_t s = 0; s < n; s++) {
+			long long current = (s < stats.freq.size()) ? stats.freq[s] : 0;
+			long long before = (s < lastFreq.size()) ? lastFreq[s] : 0;
+			if (current == before)
+				continue;
+			putVarint(entries, s - previous);
+			putSigned(entries, current - before);
+			previous = (int) s;
+			count++;
+		}
+		putVarint(delta, count);
+		delta.insert(delta.end(), entries.begin(), entries.end());
+
+		entries.clear();
+		count = 0;
+		previous = 0;
+		for (int x = 0; x < pile.width; x++) {
+			for (int y = 0; y < pile.height; y++) {
+				int i = x * pile.height + y;
+				if (pile.plate[x][y] == lastCells[i])
+					continue;
+				putVarint(entries, i - previous);
+				putVarint(entries, pile.plate[x][y]);
+				previous = i;
+				count++;
+			}
+		}
+		putVarint(delta, count);
+		delta.insert(delta.end(), entries.begin(), entries.end());
+	}
+
+	for (Client &client : clients) {
+		if (client.synced && sameSize) {
+			client.pending.push_back('D');
+			putVarint(client.pending, delta.size());
+			client.pending.insert(client.pending.end(), delta.begin(), delta.end());
+			continue;
+		}
+		if (keyframe.empty()) {
+			header(keyframe, pile, stats, rate);
+			int count = 0;
+			for (long long f : stats.freq)
+				count += (f != 0);
+			putVarint(keyframe, count);
+			int previous = 0;
+			for (std::size_t s = 0; s < stats.freq.size(); s++) {
+				if (stats.freq[s] == 0)
+					continue;
+				putVarint(keyframe, s - previous);
+				putSigned(keyframe, stats.freq[s]);
+				previous = (int) s;
+			}
+			for (int x = 0; x < pile.width; x++)
+				for (int y = 0; y < pile.height; y++)
+					putVarint(keyframe, pile.plate[x][y]);
+		}
+		client.pending.push_back('K');
+		putVarint(client.pending, keyframe.size());
+		client.pending.insert(client.pending.end(), keyframe.begin(), keyframe.end());
+		client.synced = true;
+	}
+
+	for (Client &client : clients)
+		if (!flush(client))
+			closeClient(client);
+	clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client &c) { return c.fd < 0; }), clients.end());
+
+	haveBase = true;
+	lastWidth = pile.width;
+	lastHeight = pile.height;
+	lastDrops = pile.drops;
+	lastCells.resize((std::size_t) pile.width * pile.height);
+	for (int x = 0; x < pile.width; x++)
+		std::copy(pile.plate[x].begin(), pile.plate[x].end(), lastCells.begin() + (std::size_t) x * pile.height);
+	lastFreq = stats.freq;
+	lastTime = now;
+#endif
+}
+
+void TelemetryServer::acceptClients()
+{
+#if !(defined _WIN64 || defined _WIN32)
+	int fd;
+	while ((fd = accept(listener, nullptr, nullptr)) >= 0) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+		clients.push_back({fd, false, {}, 0});
+	}
+#endif
+}
+
+//send as much queued output as the socket takes without blocking, false if the client is gone or too far behind
+bool TelemetryServer::flush(Client &client)
+{
+#if defined _WIN64 || defined _WIN32
+	return false;
+#else
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+	const int flags = MSG_DONTWAIT;
+#endif
+	while (client.sent < client.pending.size()) {
+		ssize_t n = send(client.fd, client.pending.data() + client.sent, client.pending.size() - client.sent, flags);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		client.sent += n;
+	}
+	if (client.sent == client.pending.size()) {
+		client.pending.clear();
+		client.sent = 0;
+	} else if (client.sent > (1 << 16)) {
+		client.pending.erase(client.pending.begin(), client.pending.begin() + client.sent);
+		client.sent = 0;
+	}
+	return client.pending.size() - client.sent <= maxPending;
+#endif
+}
+
+void TelemetryServer::closeClient(Client &client)
+{
+#if !(defined _WIN64 || defined _WIN32)
+	if (client.fd >= 0)
+		close(client.fd);
+#endif
+	client.fd = -1;
+}
+
+void TelemetryServer::header(std::vector<unsigned char> &payload, const Sandpile &pile, const SizeStats &stats, long long rate) const
+{
+	putVarint(payload, pile.width);
+	putVarint(payload, pile.height);
+	putVarint(payload, pile.drops);
+	putVarint(payload, stats.drops - (stats.freq.empty() ? 0 : stats.freq[0]));
+	putVarint(payload, pile.capacity);
+	putVarint(payload, pile.size);
+	putVarint(payload, rate);
+}
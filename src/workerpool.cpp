@@ -0,0 +1,69 @@
+#include "workerpool.hpp"
+
+WorkerPool &WorkerPool::shared()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
+//call task(0) .. task(tasks - 1), spread over the pool and the calling thread
+void WorkerPool::run(int tasks, const std::function<void(int)> &task)
+{
+	std::unique_lock<std::mutex> owner(running, std::try_to_lock);
+	if (!owner.owns_lock() || tasks <= 1) {
+		for (int i = 0; i < tasks; i++)
+			task(i);
+		return;
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	//the caller takes tasks too, so one thread less than tasks is enough.
+	//new threads start from the generation before this job's, so they join it instead of waiting for the next one
+	while ((int) threads.size() < tasks - 1)
+		threads.emplace_back(&WorkerPool::work, this, generation);
+	job = &task;
+	next = 0;
+	total = tasks;
+	remaining = tasks;
+	generation++;
+	wake.notify_all();
+	runTasks(lock);
+	done.wait(lock, [this]() { return remaining == 0; });
+	job = nullptr;
+}
+
+void WorkerPool::work(long long seen)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this, seen]() { return stopping || generation != seen; });
+		if (stopping)
+			return;
+		seen = generation;
+		runTasks(lock);
+	}
+}
+
+//take tasks of the current job until none are left, the lock is released while a task runs
+void WorkerPool::runTasks(std::unique_lock<std::mutex> &lock)
+{
+	while (next < total) {
+		int i = next++;
+		const std::function<void(int)> &task = *job;
+		lock.unlock();
+		task(i);
+		lock.lock();
+		if (--remaining == 0)
+			done.notify_all();
+	}
+}
@@ -0,0 +1,155 @@
+/*
+minimal telemetry client, rebuilds the plate and the size histogram from the stream of a sandpile started with
+	sandpile --telemetry <socket path>
+and prints one line per message. build with e.g.
+	g++ -std=c++17 -I../include telemetry_client.cpp -o telemetry_client
+usage: telemetry_client <socket path> [messages] [--plate]
+stops after the given number of messages (default: until the stream ends), --plate prints the final plate.
+*/
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "varint.hpp"
+
+//read exactly n bytes, false at the end of the stream
+static bool readAll(int fd, unsigned char *data, std::size_t n)
+{
+	while (n > 0) {
+		ssize_t r = read(fd, data, n);
+		if (r <= 0)
+			return false;
+		data += r;
+		n -= r;
+	}
+	return true;
+}
+
+static bool readVarint(int fd, uint64_t &x)
+{
+	unsigned char bytes[10];
+	for (int i = 0; i < 10; i++) {
+		if (!readAll(fd, &bytes[i], 1))
+			return false;
+		if (!(bytes[i] & 0x80)) {
+			std::size_t pos = 0;
+			x = getVarint(bytes, i + 1, pos);
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		std::cerr << "usage: telemetry_client <socket path> [messages] [--plate]" << std::endl;
+		return 1;
+	}
+	long long limit = -1;
+	bool printPlate = false;
+	for (int i = 2; i < argc; i++) {
+		if (std::string(argv[i]) == "--plate")
+			printPlate = true;
+		else
+			limit = std::stoll(argv[i]);
+	}
+
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+		std::cerr << "Could not connect to " << argv[1] << ": " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+
+	int width = 0, height = 0;
+	std::vector<int> cells;
+	std::map<long long, long long> freq;
+	std::vector<unsigned char> payload;
+	long long messages = 0;
+	unsigned char type;
+	uint64_t length;
+	while ((limit < 0 || messages < limit) && readAll(fd, &type, 1) && readVarint(fd, length)) {
+		payload.resize(length);
+		if (!readAll(fd, payload.data(), length))
+			break;
+		if (type != 'K' && type != 'D') {
+			std::cerr << "unknown message type " << (int) type << std::endl;
+			return 1;
+		}
+		const unsigned char *p = payload.data();
+		std::size_t pos = 0;
+		int w = (int) getVarint(p, length, pos);
+		int h = (int) getVarint(p, length, pos);
+		long long drops = (long long) getVarint(p, length, pos);
+		long long avalanches = (long long) getVarint(p, length, pos);
+		long long capacity = (long long) getVarint(p, length, pos);
+		long long size = (long long) getVarint(p, length, pos);
+		long long rate = (long long) getVarint(p, length, pos);
+
+		if (type == 'K') {
+			width = w;
+			height = h;
+			freq.clear();
+		} else if (w != width || h != height) {
+			std::cerr << "delta for a " << w << "x" << h << " plate without a keyframe" << std::endl;
+			return 1;
+		}
+
+		long long entries = (long long) getVarint(p, length, pos), s = 0;
+		for (long long i = 0; i < entries; i++) {
+			s += (long long) getVarint(p, length, pos);
+			freq[s] += getSigned(p, length, pos);
+		}
+
+		long long changed;
+		if (type == 'K') {
+			cells.assign((std::size_t) width * height, 0);
+			for (int &cell : cells)
+				cell = (int) getVarint(p, length, pos);
+			changed = (long long) cells.size();
+		} else {
+			changed = (long long) getVarint(p, length, pos);
+			long long i = 0;
+			for (long long c = 0; c < changed; c++) {
+				i += (long long) getVarint(p, length, pos);
+				if (i >= (long long) cells.size()) {
+					std::cerr << "cell index out of range" << std::endl;
+					return 1;
+				}
+				cells[i] = (int) getVarint(p, length, pos);
+			}
+		}
+
+		long long grains = 0, recorded = 0;
+		for (int cell : cells)
+			grains += cell;
+		for (auto &pair : freq)
+			recorded += pair.second;
+		messages++;
+		std::cout << (char) type << " " << width << "x" << height << " drops " << drops << " (" << rate << "/s)"
+		          << " avalanches " << avalanches << " size " << size << " capacity " << capacity
+		          << " grains " << grains << " recorded " << recorded << " changed " << changed
+		          << " bytes " << length << std::endl;
+	}
+	close(fd);
+
+	if (printPlate) {
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++)
+				std::cout << cells[(std::size_t) x * height + y];
+			std::cout << "\n";
+		}
+	}
+	return 0;
+}